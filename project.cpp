@@ -4,6 +4,24 @@
 #include <limits>
 #include <cmath>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+#include <queue>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 using namespace std;
 
 // Represents a bounding box or spatial region
@@ -16,136 +34,2735 @@ struct Rectangle {
     bool intersects(const Rectangle& other) const {
         return !(x_min > other.x_max || x_max < other.x_min || y_min > other.y_max || y_max < other.y_min);
     }
+
+    double area() const {
+        return (x_max - x_min) * (y_max - y_min);
+    }
+
+    // Smallest rectangle enclosing both this one and other
+    Rectangle merged(const Rectangle& other) const {
+        return Rectangle(std::min(x_min, other.x_min), std::min(y_min, other.y_min),
+                         std::max(x_max, other.x_max), std::max(y_max, other.y_max));
+    }
+
+    // Area that would be added by growing this rectangle to also cover other
+    double enlargement(const Rectangle& other) const {
+        return merged(other).area() - area();
+    }
+
+    // Half perimeter, the R*-tree's measure of how square a rectangle is
+    double margin() const {
+        return (x_max - x_min) + (y_max - y_min);
+    }
+
+    bool contains(const Rectangle& other) const {
+        return x_min <= other.x_min && y_min <= other.y_min && x_max >= other.x_max && y_max >= other.y_max;
+    }
+
+    bool operator==(const Rectangle& other) const {
+        return x_min == other.x_min && y_min == other.y_min && x_max == other.x_max && y_max == other.y_max;
+    }
+
+    // Area shared with other, zero if they are disjoint
+    double overlap(const Rectangle& other) const {
+        double width = std::min(x_max, other.x_max) - std::max(x_min, other.x_min);
+        double height = std::min(y_max, other.y_max) - std::max(y_min, other.y_min);
+        return (width > 0 && height > 0) ? width * height : 0;
+    }
+
+    double centerX() const { return (x_min + x_max) / 2; }
+    double centerY() const { return (y_min + y_max) / 2; }
+
+    // Squared distance from (x, y) to the closest point of this rectangle (MINDIST)
+    double minDistanceSquared(double x, double y) const {
+        double dx = std::max({x_min - x, 0.0, x - x_max});
+        double dy = std::max({y_min - y, 0.0, y - y_max});
+        return dx * dx + dy * dy;
+    }
+};
+
+// Index of the lowest set bit of mask, which is cleared. mask must not be zero.
+inline unsigned popLowestBit(uint64_t& mask) {
+#if defined(__GNUC__)
+    unsigned index = static_cast<unsigned>(__builtin_ctzll(mask));
+#else
+    unsigned index = 0;
+    while (!((mask >> index) & 1)) ++index;
+#endif
+    mask &= mask - 1;
+    return index;
+}
+
+// Hint that the cache line holding address will be read soon
+inline void prefetchRead(const void* address) {
+#if defined(__GNUC__)
+    __builtin_prefetch(address, 0, 3);
+#else
+    (void)address;
+#endif
+}
+
+// Bounding boxes stored column-wise, so that one query rectangle can be tested against a run of
+// them with SIMD compares instead of one Rectangle::intersects call per box
+struct BoxColumns {
+    std::pmr::vector<double> x_min, y_min, x_max, y_max;
+
+    explicit BoxColumns(std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+        : x_min(memory), y_min(memory), x_max(memory), y_max(memory) {}
+
+    size_t size() const { return x_min.size(); }
+
+    void clear() {
+        x_min.clear();
+        y_min.clear();
+        x_max.clear();
+        y_max.clear();
+    }
+
+    void push_back(const Rectangle& box) {
+        x_min.push_back(box.x_min);
+        y_min.push_back(box.y_min);
+        x_max.push_back(box.x_max);
+        y_max.push_back(box.y_max);
+    }
+
+    Rectangle box(size_t i) const {
+        return Rectangle(x_min[i], y_min[i], x_max[i], y_max[i]);
+    }
+
+    void set(size_t i, const Rectangle& box) {
+        x_min[i] = box.x_min;
+        y_min[i] = box.y_min;
+        x_max[i] = box.x_max;
+        y_max[i] = box.y_max;
+    }
+
+    double minDistanceSquared(size_t i, double x, double y) const {
+        double dx = std::max({x_min[i] - x, 0.0, x - x_max[i]});
+        double dy = std::max({y_min[i] - y, 0.0, y - y_max[i]});
+        return dx * dx + dy * dy;
+    }
+
+    double centerDistanceSquared(size_t i, double x, double y) const {
+        double dx = (x_min[i] + x_max[i]) / 2 - x;
+        double dy = (y_min[i] + y_max[i]) / 2 - y;
+        return dx * dx + dy * dy;
+    }
+
+    // Bit i is set when box first + i intersects range. count must be at most 64.
+    uint64_t intersectMask(const Rectangle& range, size_t first, size_t count) const {
+        const double* lx = x_min.data() + first;
+        const double* ly = y_min.data() + first;
+        const double* hx = x_max.data() + first;
+        const double* hy = y_max.data() + first;
+        uint64_t mask = 0;
+        size_t i = 0;
+
+#if defined(__AVX__)
+        const __m256d q_x_min = _mm256_set1_pd(range.x_min);
+        const __m256d q_y_min = _mm256_set1_pd(range.y_min);
+        const __m256d q_x_max = _mm256_set1_pd(range.x_max);
+        const __m256d q_y_max = _mm256_set1_pd(range.y_max);
+        for (; i + 4 <= count; i += 4) {
+            __m256d hit = _mm256_and_pd(
+                _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(lx + i), q_x_max, _CMP_LE_OQ),
+                              _mm256_cmp_pd(_mm256_loadu_pd(hx + i), q_x_min, _CMP_GE_OQ)),
+                _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(ly + i), q_y_max, _CMP_LE_OQ),
+                              _mm256_cmp_pd(_mm256_loadu_pd(hy + i), q_y_min, _CMP_GE_OQ)));
+            mask |= static_cast<uint64_t>(_mm256_movemask_pd(hit)) << i;
+        }
+#elif defined(__SSE2__)
+        const __m128d q_x_min = _mm_set1_pd(range.x_min);
+        const __m128d q_y_min = _mm_set1_pd(range.y_min);
+        const __m128d q_x_max = _mm_set1_pd(range.x_max);
+        const __m128d q_y_max = _mm_set1_pd(range.y_max);
+        for (; i + 2 <= count; i += 2) {
+            __m128d hit = _mm_and_pd(
+                _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(lx + i), q_x_max),
+                           _mm_cmpge_pd(_mm_loadu_pd(hx + i), q_x_min)),
+                _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(ly + i), q_y_max),
+                           _mm_cmpge_pd(_mm_loadu_pd(hy + i), q_y_min)));
+            mask |= static_cast<uint64_t>(_mm_movemask_pd(hit)) << i;
+        }
+#endif
+        for (; i < count; ++i) {
+            if (lx[i] <= range.x_max && hx[i] >= range.x_min && ly[i] <= range.y_max && hy[i] >= range.y_min) {
+                mask |= uint64_t(1) << i;
+            }
+        }
+        return mask;
+    }
+
+    uint64_t intersectMask(const Rectangle& range) const {
+        return intersectMask(range, 0, size());
+    }
+
+    // Bit i is set when the closest point of box first + i is within squared distance radius_sq
+    // of (x, y). count must be at most 64.
+    uint64_t withinDistanceMask(double x, double y, double radius_sq, size_t first, size_t count) const {
+        const double* lx = x_min.data() + first;
+        const double* ly = y_min.data() + first;
+        const double* hx = x_max.data() + first;
+        const double* hy = y_max.data() + first;
+        uint64_t mask = 0;
+        size_t i = 0;
+
+#if defined(__AVX__)
+        const __m256d px = _mm256_set1_pd(x);
+        const __m256d py = _mm256_set1_pd(y);
+        const __m256d limit = _mm256_set1_pd(radius_sq);
+        const __m256d zero = _mm256_setzero_pd();
+        for (; i + 4 <= count; i += 4) {
+            __m256d dx = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(_mm256_loadu_pd(lx + i), px), zero),
+                                       _mm256_sub_pd(px, _mm256_loadu_pd(hx + i)));
+            __m256d dy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(_mm256_loadu_pd(ly + i), py), zero),
+                                       _mm256_sub_pd(py, _mm256_loadu_pd(hy + i)));
+            __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            mask |= static_cast<uint64_t>(_mm256_movemask_pd(_mm256_cmp_pd(d2, limit, _CMP_LE_OQ))) << i;
+        }
+#elif defined(__SSE2__)
+        const __m128d px = _mm_set1_pd(x);
+        const __m128d py = _mm_set1_pd(y);
+        const __m128d limit = _mm_set1_pd(radius_sq);
+        const __m128d zero = _mm_setzero_pd();
+        for (; i + 2 <= count; i += 2) {
+            __m128d dx = _mm_max_pd(_mm_max_pd(_mm_sub_pd(_mm_loadu_pd(lx + i), px), zero),
+                                    _mm_sub_pd(px, _mm_loadu_pd(hx + i)));
+            __m128d dy = _mm_max_pd(_mm_max_pd(_mm_sub_pd(_mm_loadu_pd(ly + i), py), zero),
+                                    _mm_sub_pd(py, _mm_loadu_pd(hy + i)));
+            __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+            mask |= static_cast<uint64_t>(_mm_movemask_pd(_mm_cmple_pd(d2, limit))) << i;
+        }
+#endif
+        for (; i < count; ++i) {
+            if (minDistanceSquared(first + i, x, y) <= radius_sq) {
+                mask |= uint64_t(1) << i;
+            }
+        }
+        return mask;
+    }
+
+    uint64_t withinDistanceMask(double x, double y, double radius_sq) const {
+        return withinDistanceMask(x, y, radius_sq, 0, size());
+    }
+};
+
+// Position of (x, y) along a Hilbert curve of order 32 laid over world. Points outside world are
+// clamped to its edge.
+uint64_t hilbertKey(double x, double y, const Rectangle& world) {
+    auto quantize = [](double v, double lo, double hi) -> uint32_t {
+        double t = hi > lo ? (v - lo) / (hi - lo) : 0.0;
+        t = std::clamp(t, 0.0, 1.0);
+        return static_cast<uint32_t>(t * 4294967295.0);
+    };
+    uint32_t hx = quantize(x, world.x_min, world.x_max);
+    uint32_t hy = quantize(y, world.y_min, world.y_max);
+
+    uint64_t key = 0;
+    for (uint32_t s = 1u << 31; s > 0; s >>= 1) {
+        uint32_t rx = (hx & s) ? 1 : 0;
+        uint32_t ry = (hy & s) ? 1 : 0;
+        key += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so the sub-curve has the canonical orientation
+        if (ry == 0) {
+            if (rx == 1) {
+                hx = ~hx;
+                hy = ~hy;
+            }
+            std::swap(hx, hy);
+        }
+    }
+    return key;
+}
+
+const double kPi = 3.14159265358979323846;
+const double kEarthRadiusKm = 6371.0088;  // Mean Earth radius of the WGS84 ellipsoid
+const double kRadiansPerDegree = kPi / 180;
+
+// Haversine term sin^2(dlat/2) + cos(lat1) cos(lat2) sin^2(dlon/2) between two points given in
+// degrees. It grows monotonically with great-circle distance, so radius tests compare it against
+// haversineLimit instead of paying for asin and sqrt per point.
+inline double haversineTerm(double lon1, double lat1, double lon2, double lat2) {
+    double sin_dlat = std::sin((lat2 - lat1) * kRadiansPerDegree / 2);
+    double sin_dlon = std::sin((lon2 - lon1) * kRadiansPerDegree / 2);
+    return sin_dlat * sin_dlat
+        + std::cos(lat1 * kRadiansPerDegree) * std::cos(lat2 * kRadiansPerDegree) * sin_dlon * sin_dlon;
+}
+
+// Haversine term of a great-circle distance of distance_km
+inline double haversineLimit(double distance_km) {
+    double half_angle = std::min(distance_km / kEarthRadiusKm, kPi) / 2;
+    return std::sin(half_angle) * std::sin(half_angle);
+}
+
+// Great-circle distance in km for a haversine term
+inline double greatCircleKm(double term) {
+    return 2 * kEarthRadiusKm * std::asin(std::sqrt(std::clamp(term, 0.0, 1.0)));
+}
+
+// Smallest haversine term from (lon, lat) to any point of box, whose x is longitude and y is
+// latitude in degrees. Outside the box's longitudes the closest point lies on the nearer meridian
+// edge. Within 90 degrees of longitude that is where the great circle through the meridian comes
+// closest to the point, clamped to the box; farther away the distance peaks inside the meridian,
+// so the closer end of the edge is the nearest point.
+inline double geoMinHaversine(const Rectangle& box, double lon, double lat) {
+    if (lon >= box.x_min && lon <= box.x_max) {
+        double closest_lat = std::clamp(lat, box.y_min, box.y_max);
+        return haversineTerm(lon, lat, lon, closest_lat);
+    }
+
+    double to_min = std::abs(std::remainder(lon - box.x_min, 360.0));
+    double to_max = std::abs(std::remainder(lon - box.x_max, 360.0));
+    double edge = to_min <= to_max ? box.x_min : box.x_max;
+    double dlon = std::min(to_min, to_max) * kRadiansPerDegree;
+
+    if (std::cos(dlon) <= 0) {
+        return std::min(haversineTerm(lon, lat, edge, box.y_min), haversineTerm(lon, lat, edge, box.y_max));
+    }
+    double closest_lat = std::atan(std::tan(lat * kRadiansPerDegree) / std::cos(dlon)) / kRadiansPerDegree;
+    closest_lat = std::clamp(closest_lat, box.y_min, box.y_max);
+    return haversineTerm(lon, lat, edge, closest_lat);
+}
+
+// Longitude/latitude boxes that together cover every point within distance_km of (lon, lat), for
+// longitudes in [-180, 180]. The longitude half-width is asin(sin(d) / cos(lat)), the exact extent
+// of the circle. A range crossing the antimeridian is split in two, and a circle reaching a pole
+// covers every longitude. Returns the number of boxes written.
+inline size_t geoSearchBoxes(double lon, double lat, double distance_km, Rectangle boxes[2]) {
+    double angle = distance_km / kEarthRadiusKm;
+    double lat_min = lat - angle / kRadiansPerDegree;
+    double lat_max = lat + angle / kRadiansPerDegree;
+    if (angle >= kPi || lat_min <= -90 || lat_max >= 90) {
+        boxes[0] = Rectangle(-180, std::max(lat_min, -90.0), 180, std::min(lat_max, 90.0));
+        return 1;
+    }
+
+    double half_width = std::asin(std::sin(angle) / std::cos(lat * kRadiansPerDegree)) / kRadiansPerDegree;
+    double lon_min = lon - half_width;
+    double lon_max = lon + half_width;
+    if (lon_min < -180) {
+        boxes[0] = Rectangle(lon_min + 360, lat_min, 180, lat_max);
+        boxes[1] = Rectangle(-180, lat_min, lon_max, lat_max);
+        return 2;
+    }
+    if (lon_max > 180) {
+        boxes[0] = Rectangle(lon_min, lat_min, 180, lat_max);
+        boxes[1] = Rectangle(-180, lat_min, lon_max - 360, lat_max);
+        return 2;
+    }
+    boxes[0] = Rectangle(lon_min, lat_min, lon_max, lat_max);
+    return 1;
+}
+
+// Append-only pool of distinct strings addressed by 32-bit handles. Equal strings are stored
+// once, back to back in chunks that grow geometrically, and a string never moves once interned.
+class StringPool {
+    static constexpr size_t kMinChunkSize = 1024;
+    static constexpr size_t kMaxChunkSize = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* free_space = nullptr;  // Unused tail of the newest chunk
+    size_t free_bytes = 0;
+    size_t chunk_bytes = 0;      // Total size of all chunks
+    std::vector<std::string_view> strings;  // Indexed by handle
+    std::unordered_map<std::string_view, uint32_t> handles;
+
+public:
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    // Handle of text, adding it to the pool if it is not there yet
+    uint32_t intern(std::string_view text) {
+        auto found = handles.find(text);
+        if (found != handles.end()) return found->second;
+
+        char* storage;
+        if (text.size() > kMaxChunkSize / 4) {
+            // Large strings get a chunk of their own so the current chunk's tail is not wasted
+            chunks.emplace_back(new char[text.size()]);
+            chunk_bytes += text.size();
+            storage = chunks.back().get();
+        } else {
+            if (text.size() > free_bytes) {
+                size_t chunk_size = std::clamp(chunk_bytes, kMinChunkSize, kMaxChunkSize);
+                chunks.emplace_back(new char[chunk_size]);
+                chunk_bytes += chunk_size;
+                free_space = chunks.back().get();
+                free_bytes = chunk_size;
+            }
+            storage = free_space;
+            free_space += text.size();
+            free_bytes -= text.size();
+        }
+        std::copy(text.begin(), text.end(), storage);
+
+        uint32_t handle = static_cast<uint32_t>(strings.size());
+        strings.push_back(std::string_view(storage, text.size()));
+        handles.emplace(strings.back(), handle);
+        return handle;
+    }
+
+    std::string_view view(uint32_t handle) const { return strings[handle]; }
+
+    size_t size() const { return strings.size(); }
+
+    // Approximate heap footprint: chunks, the handle table and the lookup index
+    size_t memoryBytes() const {
+        return chunk_bytes + strings.capacity() * sizeof(std::string_view)
+            + handles.bucket_count() * sizeof(void*)
+            + handles.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void*));
+    }
+};
+
+// Represents a property with its details and bounding box. The location is a handle into the
+// owning tree's StringPool, so a property is only fixed-size numeric fields. Trees keep the
+// fields in a PropertyStore; Property is the row passed in and handed back.
+class Property {
+public:
+    double price;
+    double area;
+    int bedrooms;
+    uint32_t location;
+    Rectangle bbox;
+
+    Property(uint32_t loc, double p, double a, int b, const Rectangle& box)
+        : price(p), area(a), bedrooms(b), location(loc), bbox(box) {}
+};
+
+// Row of a property in its tree's PropertyStore. Ids stay stable until the property is removed.
+using PropertyId = uint32_t;
+
+// Sentinel for "no property"
+const PropertyId kNoProperty = std::numeric_limits<PropertyId>::max();
+
+// Numeric property attributes that queries can rank by
+enum class PropertyAttribute {
+    Price,
+    Area,
+    Bedrooms
+};
+
+// Property fields stored column-wise: row i of every column belongs to property i. Leaves hold
+// row ids, so predicates over one attribute scan a contiguous array rather than chasing a pointer
+// per candidate. Rows of removed properties are reused by later additions.
+class PropertyStore {
+public:
+    std::vector<double> price;
+    std::vector<double> area;
+    std::vector<int> bedrooms;
+    std::vector<uint32_t> location;
+    BoxColumns bbox;
+
+private:
+    std::vector<uint8_t> live_rows;  // 1 while the row holds a property
+    std::vector<PropertyId> free_rows;
+    size_t live = 0;
+
+public:
+    PropertyId add(const Property& prop) {
+        PropertyId id;
+        if (!free_rows.empty()) {
+            id = free_rows.back();
+            free_rows.pop_back();
+            set(id, prop);
+        } else {
+            id = static_cast<PropertyId>(rows());
+            price.push_back(prop.price);
+            area.push_back(prop.area);
+            bedrooms.push_back(prop.bedrooms);
+            location.push_back(prop.location);
+            bbox.push_back(prop.bbox);
+            live_rows.push_back(0);
+        }
+        live_rows[id] = 1;
+        ++live;
+        return id;
+    }
+
+    void set(PropertyId id, const Property& prop) {
+        price[id] = prop.price;
+        area[id] = prop.area;
+        bedrooms[id] = prop.bedrooms;
+        location[id] = prop.location;
+        bbox.set(id, prop.bbox);
+    }
+
+    void erase(PropertyId id) {
+        live_rows[id] = 0;
+        free_rows.push_back(id);
+        --live;
+    }
+
+    bool contains(PropertyId id) const {
+        return id < live_rows.size() && live_rows[id];
+    }
+
+    Property row(PropertyId id) const {
+        return Property(location[id], price[id], area[id], bedrooms[id], bbox.box(id));
+    }
+
+    Rectangle box(PropertyId id) const { return bbox.box(id); }
+
+    double value(PropertyId id, PropertyAttribute attribute) const {
+        switch (attribute) {
+        case PropertyAttribute::Price: return price[id];
+        case PropertyAttribute::Area: return area[id];
+        case PropertyAttribute::Bedrooms: return bedrooms[id];
+        }
+        return 0;
+    }
+
+    // Number of properties, and number of rows including free ones
+    size_t size() const { return live; }
+    size_t rows() const { return price.size(); }
+
+    void clear() {
+        price.clear();
+        area.clear();
+        bedrooms.clear();
+        location.clear();
+        bbox.clear();
+        live_rows.clear();
+        free_rows.clear();
+        live = 0;
+    }
+
+    // Heap footprint of the columns and the free list
+    size_t memoryBytes() const {
+        return price.capacity() * sizeof(double) + area.capacity() * sizeof(double)
+            + bedrooms.capacity() * sizeof(int) + location.capacity() * sizeof(uint32_t)
+            + 4 * bbox.x_min.capacity() * sizeof(double)
+            + live_rows.capacity() * sizeof(uint8_t) + free_rows.capacity() * sizeof(PropertyId);
+    }
+};
+
+// Memory used by the properties of a tree, next to what the same properties cost when each one
+// carried its own std::string location
+struct MemoryReport {
+    size_t property_count = 0;
+    size_t distinct_locations = 0;
+    size_t property_bytes = 0;         // Property columns plus the shared location pool
+    size_t legacy_property_bytes = 0;  // Records with an inline std::string plus their heap buffers
+
+    double bytesPerProperty() const {
+        return property_count ? static_cast<double>(property_bytes) / property_count : 0;
+    }
+
+    double legacyBytesPerProperty() const {
+        return property_count ? static_cast<double>(legacy_property_bytes) / property_count : 0;
+    }
+};
+
+// Node split algorithms from Guttman's original R-tree paper
+enum class SplitAlgorithm {
+    Linear,     // O(M) seed selection, cheaper splits but more overlap
+    Quadratic   // O(M^2) seed selection, tighter nodes
+};
+
+// How entries are routed down the tree and how overflowing nodes are handled
+enum class InsertionMode {
+    Guttman,  // Least-enlargement descent and the configured SplitAlgorithm
+    RStar,    // Beckmann et al.: overlap-aware descent, forced reinsertion, margin/overlap split
+    Hilbert   // Kamel & Faloutsos: entries kept in Hilbert order, 2-to-3 splits with a sibling
+};
+
+// Order in which bulkLoad packs entries into nodes
+enum class PackingOrder {
+    SortTileRecursive,  // Slice by x, then sort by y within each slice
+    Hilbert             // Sort by the Hilbert key of each bounding box centre
+};
+
+// Direction of a ranking: Ascending puts the smallest value first
+enum class SortOrder {
+    Ascending,
+    Descending
+};
+
+// How point coordinates and distances are interpreted by radius queries and kNearest
+enum class CoordinateMode {
+    Planar,     // x and y in one planar unit; Euclidean distances in that unit
+    Geographic  // x is WGS84 longitude in [-180, 180] and y latitude, in degrees; great-circle km
+};
+
+// Upper bound on max_entries, so the entries of any node fit one 64-bit intersection mask
+const size_t kMaxFanout = 64;
+
+// Upper bound on the level of the root. Every node but the root holds at least min_entries >= 2
+// entries and the root at least two, so a tree this tall would need more properties than a
+// 32-bit PropertyId can address. Traversals size their fixed stacks by it.
+const size_t kMaxTreeHeight = 32;
+
+// Structural parameters of the R-tree
+struct RTreeOptions {
+    size_t max_entries = 16;  // M: entries a node may hold before it is split (at most kMaxFanout)
+    size_t min_entries = 6;   // m: entries each half of a split must receive (m <= M / 2)
+    SplitAlgorithm split = SplitAlgorithm::Quadratic;
+    InsertionMode mode = InsertionMode::Guttman;
+    double reinsert_fraction = 0.3;  // R* only: share of an overflowing node reinserted on first overflow
+    PackingOrder packing = PackingOrder::SortTileRecursive;  // Always Hilbert in Hilbert mode
+    Rectangle hilbert_world = Rectangle(0, 0, 100, 100);     // Hilbert mode: extent the curve is laid over
+    CoordinateMode coordinates = CoordinateMode::Planar;
+};
+
+// Attribute predicates shared by the filtered queries; the defaults accept every property
+struct PropertyFilter {
+    double max_price = std::numeric_limits<double>::infinity();
+    double min_area = -std::numeric_limits<double>::infinity();
+    int min_bedrooms = std::numeric_limits<int>::min();
+
+    bool matches(const PropertyStore& store, PropertyId id) const {
+        return store.price[id] <= max_price && store.area[id] >= min_area && store.bedrooms[id] >= min_bedrooms;
+    }
+};
+
+// Attribute bounds over every property below a node. A filtered query can skip the node when no
+// property within these bounds could pass its filter, and a ranked query when none could rank
+// high enough. The count and sums let aggregate queries take a whole subtree at once.
+struct SubtreeStats {
+    double min_price = std::numeric_limits<double>::infinity();
+    double max_price = -std::numeric_limits<double>::infinity();
+    double min_area = std::numeric_limits<double>::infinity();
+    double max_area = -std::numeric_limits<double>::infinity();
+    int min_bedrooms = std::numeric_limits<int>::max();
+    int max_bedrooms = std::numeric_limits<int>::min();
+    size_t count = 0;
+    double sum_price = 0;
+    double sum_area = 0;
+
+    void include(const PropertyStore& store, PropertyId id) {
+        min_price = std::min(min_price, store.price[id]);
+        max_price = std::max(max_price, store.price[id]);
+        min_area = std::min(min_area, store.area[id]);
+        max_area = std::max(max_area, store.area[id]);
+        min_bedrooms = std::min(min_bedrooms, store.bedrooms[id]);
+        max_bedrooms = std::max(max_bedrooms, store.bedrooms[id]);
+        ++count;
+        sum_price += store.price[id];
+        sum_area += store.area[id];
+    }
+
+    void include(const SubtreeStats& other) {
+        min_price = std::min(min_price, other.min_price);
+        max_price = std::max(max_price, other.max_price);
+        min_area = std::min(min_area, other.min_area);
+        max_area = std::max(max_area, other.max_area);
+        min_bedrooms = std::min(min_bedrooms, other.min_bedrooms);
+        max_bedrooms = std::max(max_bedrooms, other.max_bedrooms);
+        count += other.count;
+        sum_price += other.sum_price;
+        sum_area += other.sum_area;
+    }
+
+    bool mayMatch(const PropertyFilter& filter) const {
+        return min_price <= filter.max_price && max_area >= filter.min_area && max_bedrooms >= filter.min_bedrooms;
+    }
+
+    double minimum(PropertyAttribute attribute) const {
+        switch (attribute) {
+        case PropertyAttribute::Price: return min_price;
+        case PropertyAttribute::Area: return min_area;
+        case PropertyAttribute::Bedrooms: return min_bedrooms;
+        }
+        return 0;
+    }
+
+    double maximum(PropertyAttribute attribute) const {
+        switch (attribute) {
+        case PropertyAttribute::Price: return max_price;
+        case PropertyAttribute::Area: return max_area;
+        case PropertyAttribute::Bedrooms: return max_bedrooms;
+        }
+        return 0;
+    }
+};
+
+// Totals over the properties a range query would return
+struct RangeAggregate {
+    size_t count = 0;
+    double sum_price = 0;
+    double sum_area = 0;
+
+    double averagePrice() const { return count ? sum_price / count : 0; }
+    double averageArea() const { return count ? sum_area / count : 0; }
+};
+
+// Price statistics of the properties binned into one heatmap cell
+struct HeatmapCell {
+    size_t count = 0;
+    double min_price = std::numeric_limits<double>::infinity();
+    double max_price = -std::numeric_limits<double>::infinity();
+    double sum_price = 0;
+
+    double averagePrice() const { return count ? sum_price / count : 0; }
+};
+
+// Result of RTree::heatmap: the viewport cut into columns x rows equal cells, stored row by row
+// starting from the cell at (x_min, y_min)
+struct Heatmap {
+    Rectangle viewport;
+    size_t columns = 0;
+    size_t rows = 0;
+    std::vector<HeatmapCell> cells;
+
+    const HeatmapCell& cell(size_t column, size_t row) const { return cells[row * columns + column]; }
+};
+
+// Slab allocator for objects of one type. Objects are carved out of fixed-size slabs, recycled
+// slots are reused before new ones, and release() hands back every slab in one pass without
+// running the destructors of live objects, so T must either be trivially destructible or own
+// nothing that is not released alongside the pool.
+template <typename T>
+class SlabPool {
+    static constexpr size_t kSlabObjects = 256;
+
+    struct alignas(T) Slot {
+        unsigned char bytes[sizeof(T)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> slabs;
+    std::vector<T*> free_slots;
+    size_t next_in_slab = kSlabObjects;  // Bump position in the newest slab
+
+public:
+    SlabPool() = default;
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    ~SlabPool() { release(); }
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        void* slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            if (next_in_slab == kSlabObjects) {
+                slabs.emplace_back(new Slot[kSlabObjects]);
+                next_in_slab = 0;
+            }
+            slot = &slabs.back()[next_in_slab++];
+        }
+        return new (slot) T(std::forward<Args>(args)...);
+    }
+
+    void recycle(T* object) {
+        object->~T();
+        free_slots.push_back(object);
+    }
+
+    void release() {
+        slabs.clear();
+        free_slots.clear();
+        next_in_slab = kSlabObjects;
+    }
+};
+
+// Fixed set of worker threads running tasks from per-worker deques. A worker takes its newest task
+// first and, when its own deque is empty, steals the oldest task of another worker, so skewed
+// work spreads out on its own. Tasks receive the index of the worker running them and may
+// submit further tasks, typically to that same worker.
+class ThreadPool {
+public:
+    using Task = std::function<void(size_t worker)>;
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex state_lock;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+    size_t queued = 0;      // Tasks sitting in some deque
+    size_t unfinished = 0;  // Tasks submitted and not yet finished
+    bool stopping = false;
+
+public:
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency()) {
+        thread_count = std::max<size_t>(thread_count, 1);
+        for (size_t i = 0; i < thread_count; ++i) {
+            workers.emplace_back(new Worker);
+        }
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    size_t size() const { return workers.size(); }
+
+    // Queue task on the deque of worker (taken modulo size())
+    void submit(size_t worker, Task task) {
+        Worker& target = *workers[worker % workers.size()];
+        // Counted before the task is visible, so a thief can never finish it ahead of the count
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            ++queued;
+            ++unfinished;
+        }
+        {
+            std::lock_guard<std::mutex> guard(target.lock);
+            target.tasks.push_back(std::move(task));
+        }
+        work_ready.notify_one();
+    }
+
+    // Block until every submitted task, including tasks submitted by tasks, has finished. Must not
+    // be called from a task of this pool: the calling worker would wait on itself, which is also
+    // why a task must not call queryParallel or queryBatchParallel with its own pool.
+    void wait() {
+        std::unique_lock<std::mutex> guard(state_lock);
+        all_done.wait(guard, [this] { return unfinished == 0; });
+    }
+
+private:
+    void run(size_t self) {
+        for (;;) {
+            Task task;
+            if (!take(self, task)) {
+                std::unique_lock<std::mutex> guard(state_lock);
+                work_ready.wait(guard, [this] { return stopping || queued > 0; });
+                if (stopping && queued == 0) return;
+                continue;
+            }
+
+            task(self);
+            std::lock_guard<std::mutex> guard(state_lock);
+            if (--unfinished == 0) {
+                all_done.notify_all();
+            }
+        }
+    }
+
+    // Newest task of worker self, or else the oldest task of the first other worker that has one
+    bool take(size_t self, Task& task) {
+        for (size_t k = 0; k < workers.size(); ++k) {
+            Worker& victim = *workers[(self + k) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            if (k == 0) {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+            } else {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> state_guard(state_lock);
+            --queued;
+            return true;
+        }
+        return false;
+    }
+};
+
+// Represents an R-tree node which can either be an internal node or a leaf node
+class RTreeNode {
+public:
+    std::pmr::vector<RTreeNode*> children;  // For internal nodes, this holds the child nodes
+    std::pmr::vector<PropertyId> leaf_properties; // For leaf nodes, this holds property row ids
+    BoxColumns entry_boxes;  // Copies of the children's or properties' boxes, in entry order
+    Rectangle bounding_box;
+    SubtreeStats stats;      // Attribute bounds of every property in this subtree
+    bool is_leaf;
+    uint64_t lhv = 0;  // Largest Hilbert value in this subtree (Hilbert mode and Hilbert-packed trees)
+
+    // Entry vectors are allocated from memory, normally the owning tree's node arena
+    RTreeNode(Rectangle bbox, bool leaf, std::pmr::memory_resource* memory)
+        : children(memory), leaf_properties(memory), entry_boxes(memory), bounding_box(bbox), is_leaf(leaf) {}
+
+    size_t entryCount() const {
+        return is_leaf ? leaf_properties.size() : children.size();
+    }
 };
 
-// Represents a property with its details and bounding box
-class Property {
-public:
-    std::string location;
-    double price;
-    double area;
-    int bedrooms;
-    Rectangle bbox;
+// Represents the R-tree structure
+class RTree {
+    friend class FrozenRTree;
+    friend class QueryCursor;
+
+    // The tree owns its nodes and properties. Node entry vectors come from entry_memory, so nodes
+    // are dropped with their slabs without running destructors. Leaves refer to rows of store.
+    std::pmr::unsynchronized_pool_resource entry_memory;
+    SlabPool<RTreeNode> node_pool;
+    PropertyStore store;
+    StringPool locations;  // Kept across clear() so handles given out stay valid
+
+    RTreeNode* root;
+    RTreeOptions options;
+    size_t height = 0;  // Level of the root; leaves are level 0
+    // Starts at a random value per tree (and per reset) and is bumped by every modification, so
+    // cursors and tokens can tell the tree changed or belong to another tree entirely
+    uint64_t epoch = freshEpoch();
+
+    // Held shared by parallel queries and exclusively by the modifying methods, so a tree is never
+    // modified while worker threads read it
+    mutable std::shared_mutex access;
+
+    // An entry to be placed at a given level: a property for level 0, a subtree above that
+    struct PendingEntry {
+        PropertyId prop;  // kNoProperty for subtrees
+        RTreeNode* node;  // nullptr for properties
+        size_t level;
+    };
+
+    // State shared across one top-level insertion, including the entries it evicted for reinsertion
+    struct InsertContext {
+        std::vector<bool> reinserted_level;
+        std::vector<PendingEntry> reinsert_queue;
+    };
+
+    // A block of queryCircle candidates gathered out of the property columns, so the distance and
+    // attribute predicates can be evaluated for the whole block with SIMD compares
+    struct CandidateBlock {
+        static constexpr size_t kCapacity = 64;  // One bit per candidate in a 64-bit mask
+
+        alignas(32) double center_x[kCapacity];
+        alignas(32) double center_y[kCapacity];
+        alignas(32) double price[kCapacity];
+        alignas(32) double area[kCapacity];
+        alignas(32) double bedrooms[kCapacity];
+        alignas(32) double distance_sq[kCapacity];  // Filled in by matchMask
+        alignas(32) double haversine[kCapacity];    // Filled in by withinGreatCircle
+        size_t count = 0;
+
+        void gather(const PropertyStore& store, const PropertyId* ids, size_t n) {
+            const BoxColumns& boxes = store.bbox;
+            for (size_t i = 0; i < n; ++i) {
+                PropertyId id = ids[i];
+                center_x[i] = (boxes.x_min[id] + boxes.x_max[id]) / 2;
+                center_y[i] = (boxes.y_min[id] + boxes.y_max[id]) / 2;
+                price[i] = store.price[id];
+                area[i] = store.area[id];
+                bedrooms[i] = store.bedrooms[id];
+            }
+            count = n;
+        }
+
+        // Bit i is set when candidate i passes filter and its centre is within squared distance
+        // radius_sq of (x, y)
+        uint64_t matchMask(double x, double y, double radius_sq, const PropertyFilter& filter) {
+            const double min_bedrooms = filter.min_bedrooms;
+            uint64_t mask = 0;
+            size_t i = 0;
+
+#if defined(__AVX__)
+            const __m256d px = _mm256_set1_pd(x);
+            const __m256d py = _mm256_set1_pd(y);
+            const __m256d limit = _mm256_set1_pd(radius_sq);
+            const __m256d max_price = _mm256_set1_pd(filter.max_price);
+            const __m256d min_area = _mm256_set1_pd(filter.min_area);
+            const __m256d min_beds = _mm256_set1_pd(min_bedrooms);
+            for (; i + 4 <= count; i += 4) {
+                __m256d dx = _mm256_sub_pd(_mm256_load_pd(center_x + i), px);
+                __m256d dy = _mm256_sub_pd(_mm256_load_pd(center_y + i), py);
+                __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+                _mm256_store_pd(distance_sq + i, d2);
+                __m256d pass = _mm256_and_pd(
+                    _mm256_and_pd(_mm256_cmp_pd(d2, limit, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(_mm256_load_pd(price + i), max_price, _CMP_LE_OQ)),
+                    _mm256_and_pd(_mm256_cmp_pd(_mm256_load_pd(area + i), min_area, _CMP_GE_OQ),
+                                  _mm256_cmp_pd(_mm256_load_pd(bedrooms + i), min_beds, _CMP_GE_OQ)));
+                mask |= static_cast<uint64_t>(_mm256_movemask_pd(pass)) << i;
+            }
+#elif defined(__SSE2__)
+            const __m128d px = _mm_set1_pd(x);
+            const __m128d py = _mm_set1_pd(y);
+            const __m128d limit = _mm_set1_pd(radius_sq);
+            const __m128d max_price = _mm_set1_pd(filter.max_price);
+            const __m128d min_area = _mm_set1_pd(filter.min_area);
+            const __m128d min_beds = _mm_set1_pd(min_bedrooms);
+            for (; i + 2 <= count; i += 2) {
+                __m128d dx = _mm_sub_pd(_mm_load_pd(center_x + i), px);
+                __m128d dy = _mm_sub_pd(_mm_load_pd(center_y + i), py);
+                __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+                _mm_store_pd(distance_sq + i, d2);
+                __m128d pass = _mm_and_pd(
+                    _mm_and_pd(_mm_cmple_pd(d2, limit),
+                               _mm_cmple_pd(_mm_load_pd(price + i), max_price)),
+                    _mm_and_pd(_mm_cmpge_pd(_mm_load_pd(area + i), min_area),
+                               _mm_cmpge_pd(_mm_load_pd(bedrooms + i), min_beds)));
+                mask |= static_cast<uint64_t>(_mm_movemask_pd(pass)) << i;
+            }
+#endif
+            for (; i < count; ++i) {
+                double dx = center_x[i] - x;
+                double dy = center_y[i] - y;
+                distance_sq[i] = dx * dx + dy * dy;
+                if (distance_sq[i] <= radius_sq && price[i] <= filter.max_price &&
+                    area[i] >= filter.min_area && bedrooms[i] >= min_bedrooms) {
+                    mask |= uint64_t(1) << i;
+                }
+            }
+            return mask;
+        }
+
+        // The candidates of mask whose centre, read as (longitude, latitude), has a haversine
+        // term from (lon, lat) of at most limit
+        uint64_t withinGreatCircle(uint64_t mask, double lon, double lat, double limit) {
+            uint64_t within = 0;
+            while (mask) {
+                unsigned i = popLowestBit(mask);
+                haversine[i] = haversineTerm(lon, lat, center_x[i], center_y[i]);
+                if (haversine[i] <= limit) {
+                    within |= uint64_t(1) << i;
+                }
+            }
+            return within;
+        }
+    };
+
+public:
+    explicit RTree(const RTreeOptions& opts = RTreeOptions()) : options(opts) {
+        options.max_entries = std::clamp<size_t>(options.max_entries, 4, kMaxFanout);
+        options.min_entries = std::clamp<size_t>(options.min_entries, 2, options.max_entries / 2);
+        root = newNode(Rectangle(0, 0, 100, 100), true); // Define an initial bounding box
+    }
+
+    // Build the tree directly from a snapshot of properties (see bulkLoad)
+    explicit RTree(const std::vector<Property>& properties, const RTreeOptions& opts = RTreeOptions()) : RTree(opts) {
+        bulkLoad(properties);
+    }
+
+    RTree(const RTree&) = delete;
+    RTree& operator=(const RTree&) = delete;
+
+    // Drop every node and property; ids previously returned by the tree become invalid
+    void clear() {
+        std::unique_lock<std::shared_mutex> writing(access);
+        reset();
+    }
+
+    size_t size() const { return store.size(); }
+
+    // Changes whenever the tree is modified; two trees never share an epoch in practice
+    uint64_t modificationEpoch() const { return epoch; }
+
+    // Copy of the fields of property id
+    Property property(PropertyId id) const {
+        return store.row(id);
+    }
+
+    // Read-only access to the attribute columns, for scans that do not need the index
+    const PropertyStore& properties() const {
+        return store;
+    }
+
+    // Handle for a location name, to be stored in Property::location
+    uint32_t internLocation(std::string_view name) {
+        return locations.intern(name);
+    }
+
+    std::string_view locationName(const Property& prop) const {
+        return locations.view(prop.location);
+    }
+
+    std::string_view locationName(PropertyId id) const {
+        return locations.view(store.location[id]);
+    }
+
+    // Bytes per property with interned locations, against one std::string per property
+    MemoryReport memoryReport() const {
+        // Layout of Property before locations were interned
+        struct LegacyProperty {
+            std::string location;
+            double price;
+            double area;
+            int bedrooms;
+            Rectangle bbox;
+        };
+        const size_t inline_capacity = std::string().capacity();
+
+        MemoryReport report;
+        report.property_count = size();
+        report.distinct_locations = locations.size();
+        report.property_bytes = store.memoryBytes() + locations.memoryBytes();
+        report.legacy_property_bytes = size() * sizeof(LegacyProperty);
+        for (PropertyId id = 0; id < store.rows(); ++id) {
+            if (!store.contains(id)) continue;
+            size_t length = locations.view(store.location[id]).size();
+            if (length > inline_capacity) {
+                report.legacy_property_bytes += length + 1;
+            }
+        }
+        return report;
+    }
+
+    // Replace the contents of the tree with copies of properties, packed bottom-up in the order
+    // given by options.packing. Every node is filled to max_entries except the last one of each
+    // level, which is balanced against its neighbour so that it still holds at least min_entries.
+    void bulkLoad(const std::vector<Property>& properties) {
+        std::unique_lock<std::shared_mutex> writing(access);
+        reset();
+        if (properties.empty()) return;
+
+        std::vector<PropertyId> entries;
+        entries.reserve(properties.size());
+        for (const auto& prop : properties) {
+            entries.push_back(store.add(prop));
+        }
+
+        if (options.mode == InsertionMode::Hilbert || options.packing == PackingOrder::Hilbert) {
+            packHilbert(entries);
+            return;
+        }
+
+        sortTileRecursive(entries);
+        std::vector<RTreeNode*> level = packSorted(entries, true);
+        while (level.size() > 1) {
+            sortTileRecursive(level);
+            level = packSorted(level, false);
+            ++height;
+        }
+        root = level[0];
+    }
+
+    // Insert a copy of a property into the R-tree, splitting overflowing nodes up to the root.
+    // The returned id stays valid until the property is removed or the tree is cleared.
+    PropertyId insert(const Property& property) {
+        std::unique_lock<std::shared_mutex> writing(access);
+        ++epoch;
+        PropertyId id = store.add(property);
+        place(id);
+        return id;
+    }
+
+    // Remove property id from the tree and free its row. Nodes left with fewer than min_entries are
+    // dissolved and their entries reinserted (condense-tree), and a root left with a single child
+    // is collapsed. Returns false if id is not in the tree.
+    bool remove(PropertyId id) {
+        std::unique_lock<std::shared_mutex> writing(access);
+        if (!store.contains(id) || !detach(id)) return false;
+        ++epoch;
+        store.erase(id);
+        return true;
+    }
+
+    // Change the attributes and bounding box of property id. Attribute-only changes are applied in
+    // place and only refresh the stats on its path. A new bounding box that still fits its leaf
+    // (and, in Hilbert mode, keeps its Hilbert key) is also updated in place; otherwise the
+    // property is removed and reinserted under the same id. Returns false if id is not in the tree.
+    bool update(PropertyId id, double price, double area, int bedrooms, const Rectangle& bbox) {
+        std::unique_lock<std::shared_mutex> writing(access);
+        std::vector<RTreeNode*> path;
+        if (!store.contains(id) || !findPath(root, id, path)) return false;
+        ++epoch;
+
+        bool stays = path.back()->bounding_box.contains(bbox);
+        if (options.mode == InsertionMode::Hilbert) {
+            stays = stays && hilbertKey(bbox.centerX(), bbox.centerY(), options.hilbert_world) == hilbertKeyOf(id);
+        }
+
+        Property updated(store.location[id], price, area, bedrooms, bbox);
+        if (bbox == store.box(id) || stays) {
+            store.set(id, updated);
+            for (size_t i = path.size(); i-- > 0;) {
+                refreshNode(path[i]);
+            }
+            return true;
+        }
+
+        detach(id);
+        store.set(id, updated);
+        place(id);
+        return true;
+    }
+
+    // Query properties within a specified range
+    std::vector<PropertyId> query(const Rectangle& range) const {
+        std::vector<PropertyId> results;
+        query(range, [&results](PropertyId id) {
+            results.push_back(id);
+            return true;
+        });
+        return results;
+    }
+
+    // Run the range queries of a batch on the workers of pool; results[q] is what query(ranges[q])
+    // returns. Queries are cut into chunks, a few per worker, and each worker starts with a run of
+    // neighbouring chunks, so stealing only kicks in when result sizes are skewed. Workers append
+    // to their own output buffer, and the buffers are split into per-query results at the end. The
+    // tree is locked against modification for the duration. Only one batch may use pool at a time.
+    std::vector<std::vector<PropertyId>> queryBatchParallel(const std::vector<Rectangle>& ranges, ThreadPool& pool) const {
+        static constexpr size_t kChunksPerWorker = 8;
+
+        std::shared_lock<std::shared_mutex> reading(access);
+        std::vector<std::vector<PropertyId>> results(ranges.size());
+        if (ranges.empty()) return results;
+
+        struct Span {
+            size_t query;
+            size_t begin, end;  // Results of query in the worker's ids
+        };
+        struct alignas(64) Output {
+            std::vector<PropertyId> ids;
+            std::vector<Span> spans;
+        };
+        std::vector<Output> outputs(pool.size());
+
+        size_t chunk_size = std::max<size_t>(1, ranges.size() / (pool.size() * kChunksPerWorker));
+        size_t chunk_count = (ranges.size() + chunk_size - 1) / chunk_size;
+        for (size_t c = 0; c < chunk_count; ++c) {
+            size_t first = c * chunk_size;
+            size_t last = std::min(ranges.size(), first + chunk_size);
+            pool.submit(c * pool.size() / chunk_count, [this, &ranges, &outputs, first, last](size_t worker) {
+                Output& out = outputs[worker];
+                auto collect = [&out](PropertyId id) {
+                    out.ids.push_back(id);
+                    return true;
+                };
+                for (size_t q = first; q < last; ++q) {
+                    size_t begin = out.ids.size();
+                    queryIterative(root, ranges[q], collect);
+                    out.spans.push_back(Span{q, begin, out.ids.size()});
+                }
+            });
+        }
+        pool.wait();
+
+        for (const auto& out : outputs) {
+            for (const auto& span : out.spans) {
+                results[span.query].assign(out.ids.begin() + span.begin, out.ids.begin() + span.end);
+            }
+        }
+        return results;
+    }
+
+    // query(range) with the traversal split across the workers of pool. Starting at the root,
+    // subtrees holding more than sequential_below properties are opened on the calling thread;
+    // every subtree at or below that size that intersects range becomes one task, traversed
+    // sequentially. Each task fills its own slot and the slots are concatenated in tree order, so
+    // the result equals query(range). The tree is locked against modification meanwhile.
+    std::vector<PropertyId> queryParallel(const Rectangle& range, ThreadPool& pool, size_t sequential_below = 4096) const {
+        std::shared_lock<std::shared_mutex> reading(access);
+        std::vector<PropertyId> results;
+        auto collect = [&results](PropertyId id) {
+            results.push_back(id);
+            return true;
+        };
+        if (root->stats.count <= sequential_below || pool.size() == 1) {
+            queryIterative(root, range, collect);
+            return results;
+        }
+
+        std::vector<const RTreeNode*> tasks;
+        splitQuery(root, range, std::max<size_t>(sequential_below, 1), tasks);
+
+        std::vector<std::vector<PropertyId>> parts(tasks.size());
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            pool.submit(t * pool.size() / tasks.size(), [this, &range, &tasks, &parts, t](size_t) {
+                std::vector<PropertyId>& part = parts[t];
+                auto append = [&part](PropertyId id) {
+                    part.push_back(id);
+                    return true;
+                };
+                queryIterative(tasks[t], range, append);
+            });
+        }
+        pool.wait();
+
+        size_t total = 0;
+        for (const auto& part : parts) {
+            total += part.size();
+        }
+        results.reserve(total);
+        for (const auto& part : parts) {
+            results.insert(results.end(), part.begin(), part.end());
+        }
+        return results;
+    }
+
+    // Stream the properties within range to visit without collecting them. visit takes a
+    // PropertyId and returns false to stop the traversal early, e.g. after the first match or a
+    // page of results. Returns false if visit stopped it.
+    template <typename Visitor>
+    bool query(const Rectangle& range, Visitor&& visit) const {
+        return queryIterative(root, range, visit);
+    }
+
+    // Run many range queries in one traversal. results[q] holds what query(ranges[q]) returns, in
+    // the same order. Each node is visited once with the set of queries still active there, and
+    // a child is entered only by the queries intersecting it. Queries are ordered along a Hilbert
+    // curve first so that the active sets stay spatially coherent.
+    std::vector<std::vector<PropertyId>> queryBatch(const std::vector<Rectangle>& ranges) const {
+        std::vector<std::vector<PropertyId>> results(ranges.size());
+        if (ranges.empty()) return results;
+
+        Rectangle world(ranges[0].centerX(), ranges[0].centerY(), ranges[0].centerX(), ranges[0].centerY());
+        for (const auto& range : ranges) {
+            world = world.merged(Rectangle(range.centerX(), range.centerY(), range.centerX(), range.centerY()));
+        }
+        std::vector<std::pair<uint64_t, uint32_t>> keyed;
+        keyed.reserve(ranges.size());
+        for (size_t q = 0; q < ranges.size(); ++q) {
+            keyed.push_back({hilbertKey(ranges[q].centerX(), ranges[q].centerY(), world), static_cast<uint32_t>(q)});
+        }
+        std::sort(keyed.begin(), keyed.end());
+
+        BatchScratch scratch;
+        for (const auto& item : keyed) {
+            if (root->bounding_box.intersects(ranges[item.second])) {
+                scratch.active[0].push_back(item.second);
+            }
+        }
+        if (!scratch.active[0].empty()) {
+            queryBatchRecursive(root, 0, ranges, scratch, results);
+        }
+        return results;
+    }
+
+    // The k properties within range that match filter and rank first by attribute, best first
+    // (e.g. the cheapest listings in a neighbourhood). Nodes are opened best-first by the bound
+    // their stats give for attribute, and the k best so far are kept in a bounded heap; once the
+    // next node's bound cannot beat the k-th best, nothing left can, and the search stops.
+    std::vector<PropertyId> topK(const Rectangle& range, size_t k, PropertyAttribute attribute,
+                                 SortOrder order = SortOrder::Ascending, const PropertyFilter& filter = PropertyFilter()) const {
+        std::vector<PropertyId> results;
+        if (k == 0 || !root->bounding_box.intersects(range)) return results;
+
+        // Keys are ranked smallest first, so descending rankings negate the values
+        bool descending = order == SortOrder::Descending;
+        auto propertyKey = [&](PropertyId id) {
+            double value = store.value(id, attribute);
+            return descending ? -value : value;
+        };
+        auto subtreeBound = [&](const SubtreeStats& stats) {
+            return descending ? -stats.maximum(attribute) : stats.minimum(attribute);
+        };
+
+        struct Ranked {
+            double key;
+            PropertyId id;
+        };
+        auto lower = [](const Ranked& a, const Ranked& b) { return a.key < b.key; };
+        std::priority_queue<Ranked, std::vector<Ranked>, decltype(lower)> best(lower);  // k-th best on top
+
+        struct Pending {
+            double bound;
+            const RTreeNode* node;
+        };
+        auto looser = [](const Pending& a, const Pending& b) { return a.bound > b.bound; };
+        std::priority_queue<Pending, std::vector<Pending>, decltype(looser)> nodes(looser);
+        nodes.push(Pending{subtreeBound(root->stats), root});
+
+        while (!nodes.empty()) {
+            Pending next = nodes.top();
+            nodes.pop();
+            if (best.size() == k && next.bound >= best.top().key) break;
+
+            const RTreeNode* node = next.node;
+            uint64_t hits = node->entry_boxes.intersectMask(range);
+            while (hits) {
+                unsigned i = popLowestBit(hits);
+                if (node->is_leaf) {
+                    PropertyId id = node->leaf_properties[i];
+                    if (!filter.matches(store, id)) continue;
+                    double key = propertyKey(id);
+                    if (best.size() < k) {
+                        best.push(Ranked{key, id});
+                    } else if (key < best.top().key) {
+                        best.pop();
+                        best.push(Ranked{key, id});
+                    }
+                } else {
+                    const RTreeNode* child = node->children[i];
+                    double bound = subtreeBound(child->stats);
+                    if (!child->stats.mayMatch(filter) || (best.size() == k && bound >= best.top().key)) continue;
+                    nodes.push(Pending{bound, child});
+                }
+            }
+        }
+
+        results.resize(best.size());
+        for (size_t i = best.size(); i-- > 0;) {
+            results[i] = best.top().id;
+            best.pop();
+        }
+        return results;
+    }
+
+    // Number of properties query(range) would return
+    size_t count(const Rectangle& range) const {
+        return aggregate(range).count;
+    }
+
+    // Count and price/area sums over the properties query(range) would return. A subtree whose
+    // box lies inside range contributes its stored totals without being descended into.
+    RangeAggregate aggregate(const Rectangle& range) const {
+        RangeAggregate result;
+        auto takeSubtree = [&](const RTreeNode* node) {
+            if (!range.contains(node->bounding_box)) return false;
+            result.count += node->stats.count;
+            result.sum_price += node->stats.sum_price;
+            result.sum_area += node->stats.sum_area;
+            return true;
+        };
+        auto addEntry = [&](const RTreeNode* leaf, unsigned i) {
+            PropertyId id = leaf->leaf_properties[i];
+            ++result.count;
+            result.sum_price += store.price[id];
+            result.sum_area += store.area[id];
+            return true;
+        };
+        traverse(root, range, takeSubtree, addEntry);
+        return result;
+    }
+
+    // Bin every property whose bounding box centre lies in viewport into a columns x rows grid over
+    // it, in one traversal. Centres on an inner cell edge go to the upper cell. A subtree whose box
+    // lies inside a single cell is added from its stored stats without being descended into.
+    Heatmap heatmap(const Rectangle& viewport, size_t columns, size_t rows) const {
+        Heatmap map;
+        map.viewport = viewport;
+        if (columns == 0 || rows == 0) return map;
+        map.columns = columns;
+        map.rows = rows;
+        map.cells.resize(columns * rows);
+
+        // Cell coordinate of a value inside [lo, hi]; monotonic, so a box's corners bound the
+        // cells of every centre inside it
+        auto cellIndex = [](double v, double lo, double hi, size_t cells) -> size_t {
+            if (!(hi > lo)) return 0;
+            return std::min(cells - 1, static_cast<size_t>((v - lo) / (hi - lo) * cells));
+        };
+        auto column = [&](double x) { return cellIndex(x, viewport.x_min, viewport.x_max, columns); };
+        auto row = [&](double y) { return cellIndex(y, viewport.y_min, viewport.y_max, rows); };
+        auto singleCell = [&](const Rectangle& box) -> HeatmapCell* {
+            if (!viewport.contains(box) || column(box.x_min) != column(box.x_max) || row(box.y_min) != row(box.y_max)) {
+                return nullptr;
+            }
+            return &map.cells[row(box.y_min) * columns + column(box.x_min)];
+        };
+        auto takeSubtree = [&](const RTreeNode* node) {
+            HeatmapCell* cell = singleCell(node->bounding_box);
+            if (!cell) return false;
+            cell->count += node->stats.count;
+            cell->sum_price += node->stats.sum_price;
+            cell->min_price = std::min(cell->min_price, node->stats.min_price);
+            cell->max_price = std::max(cell->max_price, node->stats.max_price);
+            return true;
+        };
+        auto addEntry = [&](const RTreeNode* leaf, unsigned i) {
+            double x = (leaf->entry_boxes.x_min[i] + leaf->entry_boxes.x_max[i]) / 2;
+            double y = (leaf->entry_boxes.y_min[i] + leaf->entry_boxes.y_max[i]) / 2;
+            if (x < viewport.x_min || x > viewport.x_max || y < viewport.y_min || y > viewport.y_max) return true;
+
+            double price = store.price[leaf->leaf_properties[i]];
+            HeatmapCell& cell = map.cells[row(y) * columns + column(x)];
+            ++cell.count;
+            cell.sum_price += price;
+            cell.min_price = std::min(cell.min_price, price);
+            cell.max_price = std::max(cell.max_price, price);
+            return true;
+        };
+        traverse(root, viewport, takeSubtree, addEntry);
+        return map;
+    }
+
+    // The k properties matching filter whose bounding box centres are closest to (x, y), nearest
+    // first. Nodes are expanded best-first by MINDIST and the filter is applied as leaves are
+    // expanded, so the search stops once k matches are closer than every node still queued.
+    // In geographic mode x is longitude, y latitude, and closeness is great-circle distance.
+    std::vector<PropertyId> kNearest(double x, double y, size_t k, const PropertyFilter& filter = PropertyFilter()) const {
+        std::vector<PropertyId> results;
+        if (k == 0) return results;
+
+        struct Candidate {
+            double distance;        // Squared distance, or the haversine term in geographic mode
+            const RTreeNode* node;  // Set for nodes still to expand
+            PropertyId prop;        // Set for properties ready to report
+        };
+        auto farther = [](const Candidate& a, const Candidate& b) { return a.distance > b.distance; };
+        std::priority_queue<Candidate, std::vector<Candidate>, decltype(farther)> queue(farther);
+        queue.push(Candidate{minDistanceKey(root->bounding_box, x, y), root, kNoProperty});
+
+        while (!queue.empty() && results.size() < k) {
+            Candidate next = queue.top();
+            queue.pop();
+            if (!next.node) {
+                results.push_back(next.prop);
+                continue;
+            }
+
+            const RTreeNode* node = next.node;
+            const BoxColumns& boxes = node->entry_boxes;
+            for (size_t i = 0; i < boxes.size(); ++i) {
+                if (node->is_leaf) {
+                    PropertyId prop = node->leaf_properties[i];
+                    if (filter.matches(store, prop)) {
+                        queue.push(Candidate{centerDistanceKey(boxes, i, x, y), nullptr, prop});
+                    }
+                } else if (node->children[i]->stats.mayMatch(filter)) {
+                    queue.push(Candidate{minDistanceKey(boxes, i, x, y), node->children[i], kNoProperty});
+                }
+            }
+        }
+        return results;
+    }
+
+    // Properties matching filter whose bounding box centre is within radius of (x, y). Subtrees
+    // and entries are pruned by the MINDIST of their boxes, and the survivors are tested a block at
+    // a time (see CandidateBlock), all on squared distances. If distances is given it receives the
+    // exact distance of each result, in the same order.
+    //
+    // In geographic mode x is longitude, y latitude and radius is in km. Entries are first tested
+    // against the lat/lon boxes of the circle with the SIMD intersection masks, then against
+    // their great-circle MINDIST, and candidates by the haversine term of their centre.
+    std::vector<PropertyId> queryCircle(double x, double y, double radius, const PropertyFilter& filter = PropertyFilter(),
+                                        std::vector<double>* distances = nullptr) const {
+        std::vector<PropertyId> results;
+        if (distances) distances->clear();
+        if (!(radius >= 0)) return results;
+
+        bool geographic = options.coordinates == CoordinateMode::Geographic;
+        double radius_sq = radius * radius;
+        double limit = haversineLimit(radius);
+        std::vector<PropertyId> candidates;
+        if (geographic) {
+            Rectangle search_boxes[2];
+            size_t search_count = geoSearchBoxes(x, y, radius, search_boxes);
+            collectGeoCandidates(root, x, y, limit, search_boxes, search_count, filter, candidates);
+        } else {
+            collectCircleCandidates(root, x, y, radius_sq, filter, candidates);
+        }
+
+        CandidateBlock block;
+        for (size_t first = 0; first < candidates.size(); first += CandidateBlock::kCapacity) {
+            block.gather(store, candidates.data() + first, std::min(CandidateBlock::kCapacity, candidates.size() - first));
+            uint64_t matches;
+            if (geographic) {
+                // Attributes only; the planar distance test is switched off with an infinite radius
+                matches = block.matchMask(x, y, std::numeric_limits<double>::infinity(), filter);
+                matches = block.withinGreatCircle(matches, x, y, limit);
+            } else {
+                matches = block.matchMask(x, y, radius_sq, filter);
+            }
+            while (matches) {
+                unsigned i = popLowestBit(matches);
+                results.push_back(candidates[first + i]);
+                if (distances) {
+                    distances->push_back(geographic ? greatCircleKm(block.haversine[i]) : std::sqrt(block.distance_sq[i]));
+                }
+            }
+        }
+        return results;
+    }
+
+    // Query properties near a specified location and within a distance range
+    std::vector<PropertyId> queryNearLocation(double x, double y, double distance_km, double max_price, double min_area, int min_bedrooms) const {
+        return queryCircle(x, y, distance_km, PropertyFilter{max_price, min_area, min_bedrooms});
+    }
+
+private:
+    RTreeNode* newNode(const Rectangle& bbox, bool leaf) {
+        return node_pool.create(bbox, leaf, &entry_memory);
+    }
+
+    Rectangle entryBox(const RTreeNode* node, size_t i) const {
+        return node->is_leaf ? store.box(node->leaf_properties[i]) : node->children[i]->bounding_box;
+    }
+
+    // Recompute the bounding box of node so that it tightly encloses its entries, and refresh the
+    // column copy of the entry boxes and the attribute stats that queries test against
+    void updateBoundingBox(RTreeNode* node) const {
+        node->stats = SubtreeStats();
+        if (node->is_leaf) {
+            for (const auto& prop : node->leaf_properties) {
+                node->stats.include(store, prop);
+            }
+        } else {
+            for (const auto& child : node->children) {
+                node->stats.include(child->stats);
+            }
+        }
+
+        size_t count = node->entryCount();
+        node->entry_boxes.clear();
+        if (count == 0) return;
+
+        Rectangle box = entryBox(node, 0);
+        node->entry_boxes.push_back(box);
+        for (size_t i = 1; i < count; ++i) {
+            Rectangle entry = entryBox(node, i);
+            box = box.merged(entry);
+            node->entry_boxes.push_back(entry);
+        }
+        node->bounding_box = box;
+    }
+
+    Rectangle entryBox(const PendingEntry& entry) const {
+        return entry.node ? entry.node->bounding_box : store.box(entry.prop);
+    }
+
+    // Add a stored property to the index
+    void place(PropertyId prop) {
+        if (options.mode == InsertionMode::Hilbert) {
+            insertHilbert(prop);
+            return;
+        }
+
+        insertWithReinsertion(PendingEntry{prop, nullptr, 0});
+    }
+
+    // Take prop out of the index without freeing its row, condensing the tree behind it
+    bool detach(PropertyId prop) {
+        std::vector<PendingEntry> orphans;
+        if (!removeRecursive(root, height, prop, orphans)) return false;
+
+        for (const auto& orphan : orphans) {
+            if (options.mode == InsertionMode::Hilbert) {
+                insertHilbert(orphan.prop);
+            } else {
+                insertWithReinsertion(orphan);
+            }
+        }
+
+        while (!root->is_leaf && root->children.size() == 1) {
+            RTreeNode* old_root = root;
+            root = root->children[0];
+            node_pool.recycle(old_root);
+            --height;
+        }
+        return true;
+    }
+
+    void insertWithReinsertion(const PendingEntry& entry) {
+        InsertContext context;
+        insertEntry(entry, context);
+
+        // Entries evicted by R* forced reinsertion go back in once the insertion path is consistent
+        while (!context.reinsert_queue.empty()) {
+            PendingEntry next = context.reinsert_queue.back();
+            context.reinsert_queue.pop_back();
+            insertEntry(next, context);
+        }
+    }
+
+    void insertEntry(const PendingEntry& entry, InsertContext& context) {
+        RTreeNode* sibling = insertRecursive(root, height, entry, context);
+        if (sibling) {
+            growRoot(sibling);
+        }
+    }
+
+    // Descend from node (at level) to entry's level (ChooseLeaf for properties) and add it there.
+    // Returns the new sibling if node had to be split.
+    RTreeNode* insertRecursive(RTreeNode* node, size_t level, const PendingEntry& entry, InsertContext& context) {
+        if (level == entry.level) {
+            if (node->is_leaf) {
+                node->leaf_properties.push_back(entry.prop);
+            } else {
+                node->children.push_back(entry.node);
+            }
+        } else {
+            RTreeNode* child = options.mode == InsertionMode::RStar
+                ? chooseSubtreeRStar(node, level, entryBox(entry))
+                : chooseSubtree(node, entryBox(entry));
+            RTreeNode* sibling = insertRecursive(child, level - 1, entry, context);
+            if (sibling) {
+                node->children.push_back(sibling);
+            }
+        }
+
+        if (node->entryCount() > options.max_entries) {
+            return overflowTreatment(node, level, context);
+        }
+        updateBoundingBox(node);
+        return nullptr;
+    }
+
+    // R* overflow handling: the first overflow on each level below the root evicts the entries
+    // farthest from the node centre for reinsertion; any further overflow is split
+    RTreeNode* overflowTreatment(RTreeNode* node, size_t level, InsertContext& context) {
+        if (options.mode != InsertionMode::RStar || node == root) {
+            return splitNode(node);
+        }
+        if (context.reinserted_level.size() <= level) {
+            context.reinserted_level.resize(level + 1, false);
+        }
+        if (context.reinserted_level[level]) {
+            return splitNode(node);
+        }
+        context.reinserted_level[level] = true;
+
+        updateBoundingBox(node);
+        double cx = node->bounding_box.centerX();
+        double cy = node->bounding_box.centerY();
+        size_t count = node->entryCount();
+        std::vector<std::pair<double, size_t>> by_distance;
+        by_distance.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            Rectangle box = entryBox(node, i);
+            double dx = box.centerX() - cx;
+            double dy = box.centerY() - cy;
+            by_distance.push_back({dx * dx + dy * dy, i});
+        }
+        std::sort(by_distance.begin(), by_distance.end());
+
+        size_t evict = static_cast<size_t>(options.reinsert_fraction * count);
+        evict = std::clamp<size_t>(evict, 1, count - options.min_entries);
+
+        // The queue is drained from the back, so push farthest first to reinsert the closest first
+        std::vector<int> group(count, 0);
+        for (size_t k = count; k-- > count - evict;) {
+            size_t i = by_distance[k].second;
+            group[i] = 1;
+            if (node->is_leaf) {
+                context.reinsert_queue.push_back(PendingEntry{node->leaf_properties[i], nullptr, level});
+            } else {
+                context.reinsert_queue.push_back(PendingEntry{kNoProperty, node->children[i], level});
+            }
+        }
+
+        if (node->is_leaf) {
+            std::pmr::vector<PropertyId> evicted;
+            distribute(node->leaf_properties, evicted, group);
+        } else {
+            std::pmr::vector<RTreeNode*> evicted;
+            distribute(node->children, evicted, group);
+        }
+        updateBoundingBox(node);
+        return nullptr;
+    }
+
+    // Pick the child needing the least enlargement to cover box, breaking ties by smallest area
+    RTreeNode* chooseSubtree(RTreeNode* node, const Rectangle& box) {
+        RTreeNode* best = nullptr;
+        double best_enlargement = std::numeric_limits<double>::max();
+        double best_area = std::numeric_limits<double>::max();
+
+        for (const auto& child : node->children) {
+            double enlargement = child->bounding_box.enlargement(box);
+            double area = child->bounding_box.area();
+            if (enlargement < best_enlargement || (enlargement == best_enlargement && area < best_area)) {
+                best = child;
+                best_enlargement = enlargement;
+                best_area = area;
+            }
+        }
+        return best;
+    }
+
+    // R* ChooseSubtree: above the leaves behave like Guttman; directly above the leaves pick the
+    // child whose enlargement adds the least overlap with its siblings
+    RTreeNode* chooseSubtreeRStar(RTreeNode* node, size_t level, const Rectangle& box) {
+        if (level != 1) {
+            return chooseSubtree(node, box);
+        }
+
+        RTreeNode* best = nullptr;
+        double best_overlap = std::numeric_limits<double>::max();
+        double best_enlargement = std::numeric_limits<double>::max();
+        double best_area = std::numeric_limits<double>::max();
+
+        for (const auto& child : node->children) {
+            Rectangle grown = child->bounding_box.merged(box);
+            double overlap_increase = 0;
+            for (const auto& other : node->children) {
+                if (other == child) continue;
+                overlap_increase += grown.overlap(other->bounding_box) - child->bounding_box.overlap(other->bounding_box);
+            }
+            double enlargement = grown.area() - child->bounding_box.area();
+            double area = child->bounding_box.area();
+
+            if (overlap_increase < best_overlap ||
+                (overlap_increase == best_overlap && (enlargement < best_enlargement ||
+                 (enlargement == best_enlargement && area < best_area)))) {
+                best = child;
+                best_overlap = overlap_increase;
+                best_enlargement = enlargement;
+                best_area = area;
+            }
+        }
+        return best;
+    }
+
+    // The old root and its split sibling become the two children of a new root
+    void growRoot(RTreeNode* sibling) {
+        RTreeNode* new_root = newNode(root->bounding_box, false);
+        new_root->children.push_back(root);
+        new_root->children.push_back(sibling);
+        updateBoundingBox(new_root);
+        root = new_root;
+        ++height;
+    }
+
+    // Split an overflowing node in two, moving one group into a newly created sibling
+    RTreeNode* splitNode(RTreeNode* node) {
+        std::vector<Rectangle> boxes;
+        boxes.reserve(node->entryCount());
+        for (size_t i = 0; i < node->entryCount(); ++i) {
+            boxes.push_back(entryBox(node, i));
+        }
+
+        std::vector<int> group;
+        if (options.mode == InsertionMode::RStar) {
+            group = partitionRStar(boxes);
+        } else if (options.split == SplitAlgorithm::Linear) {
+            group = partitionLinear(boxes);
+        } else {
+            group = partitionQuadratic(boxes);
+        }
+
+        RTreeNode* sibling = newNode(node->bounding_box, node->is_leaf);
+        if (node->is_leaf) {
+            distribute(node->leaf_properties, sibling->leaf_properties, group);
+        } else {
+            distribute(node->children, sibling->children, group);
+        }
+
+        updateBoundingBox(node);
+        updateBoundingBox(sibling);
+        return sibling;
+    }
+
+    // Keep group 0 entries in place and move group 1 entries to other
+    template <typename Entries>
+    static void distribute(Entries& entries, Entries& other, const std::vector<int>& group) {
+        Entries kept(entries.get_allocator());
+        kept.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            (group[i] == 0 ? kept : other).push_back(entries[i]);
+        }
+        entries.swap(kept);
+    }
+
+    // Guttman's quadratic split: seed with the most wasteful pair, then repeatedly place the
+    // entry with the strongest preference for one group
+    std::vector<int> partitionQuadratic(const std::vector<Rectangle>& boxes) {
+        size_t n = boxes.size();
+        size_t seed_a = 0, seed_b = 1;
+        double worst_waste = -std::numeric_limits<double>::max();
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = i + 1; j < n; ++j) {
+                double waste = boxes[i].merged(boxes[j]).area() - boxes[i].area() - boxes[j].area();
+                if (waste > worst_waste) {
+                    worst_waste = waste;
+                    seed_a = i;
+                    seed_b = j;
+                }
+            }
+        }
+
+        std::vector<int> group(n, -1);
+        Rectangle cover[2] = {boxes[seed_a], boxes[seed_b]};
+        size_t size[2] = {1, 1};
+        group[seed_a] = 0;
+        group[seed_b] = 1;
+
+        for (size_t remaining = n - 2; remaining > 0; --remaining) {
+            // If one group needs every remaining entry to reach the minimum fill, hand them over
+            for (int g = 0; g < 2; ++g) {
+                if (size[g] + remaining == options.min_entries) {
+                    for (size_t i = 0; i < n; ++i) {
+                        if (group[i] == -1) group[i] = g;
+                    }
+                    return group;
+                }
+            }
+
+            size_t next = 0;
+            double best_diff = -1;
+            for (size_t i = 0; i < n; ++i) {
+                if (group[i] != -1) continue;
+                double diff = std::abs(cover[0].enlargement(boxes[i]) - cover[1].enlargement(boxes[i]));
+                if (diff > best_diff) {
+                    best_diff = diff;
+                    next = i;
+                }
+            }
+
+            int g = preferredGroup(cover, size, boxes[next]);
+            group[next] = g;
+            cover[g] = cover[g].merged(boxes[next]);
+            ++size[g];
+        }
+        return group;
+    }
+
+    // Guttman's linear split: seed with the pair most separated along either axis (normalised by
+    // the extent of the whole set), then place the rest in order
+    std::vector<int> partitionLinear(const std::vector<Rectangle>& boxes) {
+        size_t n = boxes.size();
+        Rectangle extent = boxes[0];
+        size_t highest_low_x = 0, lowest_high_x = 0, highest_low_y = 0, lowest_high_y = 0;
+        for (size_t i = 1; i < n; ++i) {
+            extent = extent.merged(boxes[i]);
+            if (boxes[i].x_min > boxes[highest_low_x].x_min) highest_low_x = i;
+            if (boxes[i].x_max < boxes[lowest_high_x].x_max) lowest_high_x = i;
+            if (boxes[i].y_min > boxes[highest_low_y].y_min) highest_low_y = i;
+            if (boxes[i].y_max < boxes[lowest_high_y].y_max) lowest_high_y = i;
+        }
+
+        double extent_width = std::max(extent.x_max - extent.x_min, std::numeric_limits<double>::epsilon());
+        double extent_height = std::max(extent.y_max - extent.y_min, std::numeric_limits<double>::epsilon());
+        double separation_x = (boxes[highest_low_x].x_min - boxes[lowest_high_x].x_max) / extent_width;
+        double separation_y = (boxes[highest_low_y].y_min - boxes[lowest_high_y].y_max) / extent_height;
+
+        size_t seed_a = highest_low_x, seed_b = lowest_high_x;
+        if (separation_y > separation_x) {
+            seed_a = highest_low_y;
+            seed_b = lowest_high_y;
+        }
+        if (seed_a == seed_b) {
+            seed_b = (seed_a == 0) ? 1 : 0;
+        }
 
-    Property(const std::string& loc, double p, double a, int b, const Rectangle& box)
-        : location(loc), price(p), area(a), bedrooms(b), bbox(box) {}
-};
+        std::vector<int> group(n, -1);
+        Rectangle cover[2] = {boxes[seed_a], boxes[seed_b]};
+        size_t size[2] = {1, 1};
+        group[seed_a] = 0;
+        group[seed_b] = 1;
 
-// Represents an R-tree node which can either be an internal node or a leaf node
-class RTreeNode {
-public:
-    std::vector<RTreeNode*> children;  // For internal nodes, this holds other nodes or properties
-    std::vector<Property*> leaf_properties; // For leaf nodes, this holds properties
-    Rectangle bounding_box;
-    bool is_leaf;
+        size_t remaining = n - 2;
+        for (size_t i = 0; i < n; ++i) {
+            if (group[i] != -1) continue;
+
+            int g;
+            if (size[0] + remaining == options.min_entries) {
+                g = 0;
+            } else if (size[1] + remaining == options.min_entries) {
+                g = 1;
+            } else {
+                g = preferredGroup(cover, size, boxes[i]);
+            }
+            group[i] = g;
+            cover[g] = cover[g].merged(boxes[i]);
+            ++size[g];
+            --remaining;
+        }
+        return group;
+    }
+
+    // R* split: choose the axis whose candidate distributions have the smallest total margin, then
+    // the distribution along it with the least overlap between the halves (ties: least total area)
+    std::vector<int> partitionRStar(const std::vector<Rectangle>& boxes) {
+        size_t n = boxes.size();
+        size_t m = options.min_entries;
+
+        // Sort orders: by lower then upper x, and by lower then upper y
+        std::vector<size_t> orders[2][2];
+        for (int axis = 0; axis < 2; ++axis) {
+            for (int by_upper = 0; by_upper < 2; ++by_upper) {
+                std::vector<size_t>& order = orders[axis][by_upper];
+                order.resize(n);
+                for (size_t i = 0; i < n; ++i) order[i] = i;
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                    const Rectangle& ra = boxes[a];
+                    const Rectangle& rb = boxes[b];
+                    double la = axis == 0 ? ra.x_min : ra.y_min, lb = axis == 0 ? rb.x_min : rb.y_min;
+                    double ua = axis == 0 ? ra.x_max : ra.y_max, ub = axis == 0 ? rb.x_max : rb.y_max;
+                    return by_upper ? (ua < ub || (ua == ub && la < lb)) : (la < lb || (la == lb && ua < ub));
+                });
+            }
+        }
+
+        // Covers of every prefix and suffix of an order, so each distribution is evaluated in O(1)
+        std::vector<Rectangle> prefix(n), suffix(n);
+        auto computeCovers = [&](const std::vector<size_t>& order) {
+            prefix[0] = boxes[order[0]];
+            for (size_t i = 1; i < n; ++i) prefix[i] = prefix[i - 1].merged(boxes[order[i]]);
+            suffix[n - 1] = boxes[order[n - 1]];
+            for (size_t i = n - 1; i-- > 0;) suffix[i] = suffix[i + 1].merged(boxes[order[i]]);
+        };
+
+        int best_axis = 0;
+        double best_margin = std::numeric_limits<double>::max();
+        for (int axis = 0; axis < 2; ++axis) {
+            double margin_sum = 0;
+            for (int by_upper = 0; by_upper < 2; ++by_upper) {
+                computeCovers(orders[axis][by_upper]);
+                for (size_t k = m; k <= n - m; ++k) {
+                    margin_sum += prefix[k - 1].margin() + suffix[k].margin();
+                }
+            }
+            if (margin_sum < best_margin) {
+                best_margin = margin_sum;
+                best_axis = axis;
+            }
+        }
+
+        const std::vector<size_t>* best_order = nullptr;
+        size_t best_split = m;
+        double best_overlap = std::numeric_limits<double>::max();
+        double best_area = std::numeric_limits<double>::max();
+        for (int by_upper = 0; by_upper < 2; ++by_upper) {
+            const std::vector<size_t>& order = orders[best_axis][by_upper];
+            computeCovers(order);
+            for (size_t k = m; k <= n - m; ++k) {
+                double overlap = prefix[k - 1].overlap(suffix[k]);
+                double area = prefix[k - 1].area() + suffix[k].area();
+                if (overlap < best_overlap || (overlap == best_overlap && area < best_area)) {
+                    best_order = &order;
+                    best_split = k;
+                    best_overlap = overlap;
+                    best_area = area;
+                }
+            }
+        }
+
+        std::vector<int> group(n, 0);
+        for (size_t i = best_split; i < n; ++i) {
+            group[(*best_order)[i]] = 1;
+        }
+        return group;
+    }
+
+    // Group whose cover grows least to take box; ties go to the smaller area, then fewer entries
+    static int preferredGroup(const Rectangle cover[2], const size_t size[2], const Rectangle& box) {
+        double grow0 = cover[0].enlargement(box);
+        double grow1 = cover[1].enlargement(box);
+        if (grow0 != grow1) return grow0 < grow1 ? 0 : 1;
+        if (cover[0].area() != cover[1].area()) return cover[0].area() < cover[1].area() ? 0 : 1;
+        return size[0] <= size[1] ? 0 : 1;
+    }
+
+    Rectangle boxOf(PropertyId prop) const { return store.box(prop); }
+    Rectangle boxOf(const RTreeNode* node) const { return node->bounding_box; }
+
+    static void addEntry(RTreeNode* node, PropertyId prop) { node->leaf_properties.push_back(prop); }
+    static void addEntry(RTreeNode* node, RTreeNode* child) { node->children.push_back(child); }
+
+    // Order entries for STR packing: sort by x centre, cut into sqrt(#nodes) vertical slices of
+    // whole nodes, and sort each slice by y centre
+    template <typename Entry>
+    void sortTileRecursive(std::vector<Entry>& entries) {
+        size_t capacity = options.max_entries;
+        size_t node_count = (entries.size() + capacity - 1) / capacity;
+        size_t slice_count = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(node_count))));
+        size_t slice_len = slice_count * capacity;
+
+        std::sort(entries.begin(), entries.end(), [this](const Entry& a, const Entry& b) {
+            return boxOf(a).centerX() < boxOf(b).centerX();
+        });
+        for (size_t start = 0; start < entries.size(); start += slice_len) {
+            auto first = entries.begin() + start;
+            auto last = entries.begin() + std::min(start + slice_len, entries.size());
+            std::sort(first, last, [this](const Entry& a, const Entry& b) {
+                return boxOf(a).centerY() < boxOf(b).centerY();
+            });
+        }
+    }
+
+    // Cut already ordered entries into consecutive full nodes. Slices hold whole nodes, so only the
+    // final node can be short; if it would fall below min_entries it shares with the one before it.
+    template <typename Entry>
+    std::vector<RTreeNode*> packSorted(const std::vector<Entry>& entries, bool leaf) {
+        size_t n = entries.size();
+        size_t capacity = options.max_entries;
+        std::vector<size_t> sizes(n / capacity, capacity);
+        if (n % capacity != 0) {
+            sizes.push_back(n % capacity);
+        }
+        if (sizes.size() > 1 && sizes.back() < options.min_entries) {
+            size_t combined = sizes[sizes.size() - 2] + sizes.back();
+            sizes[sizes.size() - 2] = combined - combined / 2;
+            sizes.back() = combined / 2;
+        }
+
+        std::vector<RTreeNode*> nodes;
+        nodes.reserve(sizes.size());
+        size_t next = 0;
+        for (size_t size : sizes) {
+            RTreeNode* node = newNode(boxOf(entries[next]), leaf);
+            for (size_t i = 0; i < size; ++i) {
+                addEntry(node, entries[next++]);
+            }
+            updateBoundingBox(node);
+            nodes.push_back(node);
+        }
+        return nodes;
+    }
+
+    // Hilbert packing: sort once by key and cut every level into consecutive runs, so sibling
+    // leaves are neighbours on the curve. Outside Hilbert mode the curve covers just the data.
+    void packHilbert(const std::vector<PropertyId>& properties) {
+        const BoxColumns& boxes = store.bbox;
+        Rectangle world = options.hilbert_world;
+        if (options.mode != InsertionMode::Hilbert) {
+            world = Rectangle(boxes.box(properties[0]).centerX(), boxes.box(properties[0]).centerY(),
+                              boxes.box(properties[0]).centerX(), boxes.box(properties[0]).centerY());
+            for (const auto& prop : properties) {
+                Rectangle box = boxes.box(prop);
+                world = world.merged(Rectangle(box.centerX(), box.centerY(), box.centerX(), box.centerY()));
+            }
+        }
+
+        std::vector<std::pair<uint64_t, PropertyId>> keyed;
+        keyed.reserve(properties.size());
+        for (const auto& prop : properties) {
+            Rectangle box = boxes.box(prop);
+            keyed.push_back({hilbertKey(box.centerX(), box.centerY(), world), prop});
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::vector<PropertyId> entries;
+        entries.reserve(keyed.size());
+        for (const auto& item : keyed) {
+            entries.push_back(item.second);
+        }
+
+        std::vector<RTreeNode*> level = packSorted(entries, true);
+        size_t next = 0;
+        for (const auto& leaf : level) {
+            next += leaf->leaf_properties.size();
+            leaf->lhv = keyed[next - 1].first;
+        }
+        while (level.size() > 1) {
+            level = packSorted(level, false);
+            for (const auto& node : level) {
+                node->lhv = node->children.back()->lhv;
+            }
+            ++height;
+        }
+        root = level[0];
+    }
 
-    RTreeNode(Rectangle bbox, bool leaf = false)
-        : bounding_box(bbox), is_leaf(leaf) {}
+    uint64_t hilbertKeyOf(PropertyId prop) const {
+        Rectangle box = store.box(prop);
+        return hilbertKey(box.centerX(), box.centerY(), options.hilbert_world);
+    }
+
+    // Hilbert R-tree insertion: follow the first child whose LHV is not below the new key, keep
+    // entries sorted by key, and resolve overflow by sharing with a sibling before splitting
+    void insertHilbert(PropertyId prop) {
+        insertHilbertRecursive(root, prop, hilbertKeyOf(prop));
+        if (root->entryCount() > options.max_entries) {
+            RTreeNode* sibling = newNode(root->bounding_box, root->is_leaf);
+            if (root->is_leaf) {
+                redistribute<std::pmr::vector<PropertyId>>({&root->leaf_properties, &sibling->leaf_properties});
+            } else {
+                redistribute<std::pmr::vector<RTreeNode*>>({&root->children, &sibling->children});
+            }
+            refreshHilbertNode(root);
+            refreshHilbertNode(sibling);
+            growRoot(sibling);
+            refreshHilbertNode(root);
+        }
+    }
+
+    void insertHilbertRecursive(RTreeNode* node, PropertyId prop, uint64_t key) {
+        if (node->is_leaf) {
+            auto pos = std::upper_bound(node->leaf_properties.begin(), node->leaf_properties.end(), key,
+                [this](uint64_t k, PropertyId p) { return k < hilbertKeyOf(p); });
+            node->leaf_properties.insert(pos, prop);
+        } else {
+            size_t index = node->children.size() - 1;
+            for (size_t i = 0; i < node->children.size(); ++i) {
+                if (node->children[i]->lhv >= key) {
+                    index = i;
+                    break;
+                }
+            }
+            insertHilbertRecursive(node->children[index], prop, key);
+            if (node->children[index]->entryCount() > options.max_entries) {
+                handleHilbertOverflow(node, index);
+            }
+        }
+        refreshHilbertNode(node);
+    }
+
+    // 2-to-3 split policy: spread the overflowing child and its neighbour over both if they fit,
+    // otherwise over three nodes by adding a new one after them
+    void handleHilbertOverflow(RTreeNode* parent, size_t index) {
+        if (parent->children.size() == 1) {
+            // No neighbour to cooperate with: plain 1-to-2 split
+            RTreeNode* child = parent->children[0];
+            parent->children.push_back(newNode(child->bounding_box, child->is_leaf));
+        }
+
+        size_t first = (index + 1 < parent->children.size()) ? index : index - 1;
+        RTreeNode* left = parent->children[first];
+        RTreeNode* right = parent->children[first + 1];
+        RTreeNode* added = nullptr;
+        if (left->entryCount() + right->entryCount() > 2 * options.max_entries) {
+            added = newNode(right->bounding_box, right->is_leaf);
+        }
+
+        if (left->is_leaf) {
+            std::vector<std::pmr::vector<PropertyId>*> lists = {&left->leaf_properties, &right->leaf_properties};
+            if (added) lists.push_back(&added->leaf_properties);
+            redistribute(lists);
+        } else {
+            std::vector<std::pmr::vector<RTreeNode*>*> lists = {&left->children, &right->children};
+            if (added) lists.push_back(&added->children);
+            redistribute(lists);
+        }
+
+        refreshHilbertNode(left);
+        refreshHilbertNode(right);
+        if (added) {
+            refreshHilbertNode(added);
+            parent->children.insert(parent->children.begin() + first + 2, added);
+        }
+    }
+
+    // Spread the entries of consecutive siblings evenly over them, preserving their order
+    template <typename Entries>
+    static void redistribute(const std::vector<Entries*>& lists) {
+        std::vector<typename Entries::value_type> all;
+        for (const auto& list : lists) {
+            all.insert(all.end(), list->begin(), list->end());
+            list->clear();
+        }
+
+        size_t next = 0;
+        for (size_t i = 0; i < lists.size(); ++i) {
+            size_t share = all.size() / lists.size() + (i < all.size() % lists.size() ? 1 : 0);
+            lists[i]->assign(all.begin() + next, all.begin() + next + share);
+            next += share;
+        }
+    }
+
+    void refreshHilbertNode(RTreeNode* node) {
+        updateBoundingBox(node);
+        if (node->is_leaf) {
+            node->lhv = node->leaf_properties.empty() ? 0 : hilbertKeyOf(node->leaf_properties.back());
+        } else {
+            node->lhv = node->children.empty() ? 0 : node->children.back()->lhv;
+        }
+    }
+
+    void refreshNode(RTreeNode* node) {
+        if (options.mode == InsertionMode::Hilbert) {
+            refreshHilbertNode(node);
+        } else {
+            updateBoundingBox(node);
+        }
+    }
 
-    // Insert a property into the node
-    void insert(Property* child) {
-        if (is_leaf) {
-            leaf_properties.push_back(child);
+    // Nodes from node down to the leaf holding prop, searching only subtrees whose box contains it
+    bool findPath(RTreeNode* node, PropertyId prop, std::vector<RTreeNode*>& path) {
+        path.push_back(node);
+        if (node->is_leaf) {
+            if (std::find(node->leaf_properties.begin(), node->leaf_properties.end(), prop) != node->leaf_properties.end()) {
+                return true;
+            }
         } else {
-            children.push_back(new RTreeNode(child->bbox)); // Create a new internal node to hold this property
-            updateBoundingBox();
+            for (const auto& child : node->children) {
+                if (child->bounding_box.contains(store.box(prop)) && findPath(child, prop, path)) {
+                    return true;
+                }
+            }
         }
+        path.pop_back();
+        return false;
     }
 
-    // Update the bounding box of this node based on its children
-    void updateBoundingBox() {
-        if (children.empty() && leaf_properties.empty()) return;
-        double x_min = bounding_box.x_min;
-        double y_min = bounding_box.y_min;
-        double x_max = bounding_box.x_max;
-        double y_max = bounding_box.y_max;
+    // Remove prop from the subtree at node (at level), dissolving children that fall below
+    // min_entries into orphans to be reinserted
+    bool removeRecursive(RTreeNode* node, size_t level, PropertyId prop, std::vector<PendingEntry>& orphans) {
+        if (node->is_leaf) {
+            auto it = std::find(node->leaf_properties.begin(), node->leaf_properties.end(), prop);
+            if (it == node->leaf_properties.end()) return false;
+            node->leaf_properties.erase(it);
+        } else {
+            size_t i = 0;
+            for (; i < node->children.size(); ++i) {
+                RTreeNode* child = node->children[i];
+                if (child->bounding_box.contains(store.box(prop)) && removeRecursive(child, level - 1, prop, orphans)) {
+                    break;
+                }
+            }
+            if (i == node->children.size()) return false;
+
+            RTreeNode* child = node->children[i];
+            if (child->entryCount() < options.min_entries) {
+                node->children.erase(node->children.begin() + i);
+                dissolve(child, level - 1, orphans);
+            }
+        }
+        refreshNode(node);
+        return true;
+    }
 
-        if (is_leaf) {
-            for (const auto& prop : leaf_properties) {
-                x_min = std::min(x_min, prop->bbox.x_min);
-                y_min = std::min(y_min, prop->bbox.y_min);
-                x_max = std::max(x_max, prop->bbox.x_max);
-                y_max = std::max(y_max, prop->bbox.y_max);
+    // Queue the entries of node (at level) for reinsertion and free it. Hilbert mode only
+    // reinserts properties, so subtrees are flattened there.
+    void dissolve(RTreeNode* node, size_t level, std::vector<PendingEntry>& orphans) {
+        if (node->is_leaf) {
+            for (const auto& prop : node->leaf_properties) {
+                orphans.push_back(PendingEntry{prop, nullptr, 0});
             }
         } else {
-            for (const auto& node : children) {
-                x_min = std::min(x_min, node->bounding_box.x_min);
-                y_min = std::min(y_min, node->bounding_box.y_min);
-                x_max = std::max(x_max, node->bounding_box.x_max);
-                y_max = std::max(y_max, node->bounding_box.y_max);
+            for (const auto& child : node->children) {
+                if (options.mode == InsertionMode::Hilbert) {
+                    dissolve(child, level - 1, orphans);
+                } else {
+                    orphans.push_back(PendingEntry{kNoProperty, child, level});
+                }
+            }
+        }
+        node_pool.recycle(node);
+    }
+
+    // Depth-first range traversal of the subtree at start over a fixed stack with one frame per
+    // internal level, holding the entries of that node still to visit. Leaves are reported as soon
+    // as they are reached, and the next sibling to be visited is prefetched before descending into
+    // the current one. Returns false as soon as visit does.
+    template <typename Visitor>
+    bool queryIterative(const RTreeNode* start, const Rectangle& range, Visitor& visit) const {
+        auto descend = [](const RTreeNode*) { return false; };
+        auto entry = [&visit](const RTreeNode* leaf, unsigned i) { return visit(leaf->leaf_properties[i]); };
+        return traverse(start, range, descend, entry);
+    }
+
+    // The traversal behind queryIterative, aggregate and heatmap. Each node intersecting range,
+    // start included, is first offered to take_subtree, which returns true when it has accounted
+    // for the whole subtree so it is not descended into. Leaf entries intersecting range are passed
+    // to visit_entry as (leaf, entry index); the traversal stops as soon as visit_entry returns
+    // false, and then returns false itself.
+    template <typename SubtreeVisitor, typename EntryVisitor>
+    bool traverse(const RTreeNode* start, const Rectangle& range, SubtreeVisitor& take_subtree, EntryVisitor& visit_entry) const {
+        struct Frame {
+            const RTreeNode* node;
+            uint64_t pending;
+        };
+        Frame stack[kMaxTreeHeight + 1];
+        size_t depth = 0;
+
+        if (!start->bounding_box.intersects(range) || take_subtree(start)) return true;
+        if (start->is_leaf) return visitLeaf(start, start->entry_boxes.intersectMask(range), visit_entry);
+        stack[depth++] = Frame{start, start->entry_boxes.intersectMask(range)};
+
+        while (depth > 0) {
+            Frame& top = stack[depth - 1];
+            if (!top.pending) {
+                --depth;
+                continue;
+            }
+            const RTreeNode* child = top.node->children[popLowestBit(top.pending)];
+            if (top.pending) {
+                uint64_t rest = top.pending;
+                prefetchNode(top.node->children[popLowestBit(rest)]);
             }
+            if (take_subtree(child)) continue;
+
+            uint64_t hits = child->entry_boxes.intersectMask(range);
+            if (child->is_leaf) {
+                if (!visitLeaf(child, hits, visit_entry)) return false;
+            } else {
+                stack[depth++] = Frame{child, hits};
+            }
+        }
+        return true;
+    }
+
+    template <typename EntryVisitor>
+    static bool visitLeaf(const RTreeNode* leaf, uint64_t hits, EntryVisitor& visit_entry) {
+        while (hits) {
+            if (!visit_entry(leaf, popLowestBit(hits))) return false;
+        }
+        return true;
+    }
+
+    static uint64_t freshEpoch() {
+        std::random_device entropy;
+        return (uint64_t(entropy()) << 32) ^ entropy();
+    }
+
+    void reset() {
+        epoch = freshEpoch();
+        node_pool.release();
+        store.clear();
+        entry_memory.release();
+        height = 0;
+        root = newNode(Rectangle(0, 0, 100, 100), true);
+    }
+
+    // Subtrees below node that intersect range and hold at most grain properties, in the order a
+    // depth-first traversal reaches them. A leaf always ends the descent, however large.
+    void splitQuery(const RTreeNode* node, const Rectangle& range, size_t grain, std::vector<const RTreeNode*>& tasks) const {
+        if (node->is_leaf || node->stats.count <= grain) {
+            tasks.push_back(node);
+            return;
+        }
+        uint64_t hits = node->entry_boxes.intersectMask(range);
+        while (hits) {
+            splitQuery(node->children[popLowestBit(hits)], range, grain, tasks);
+        }
+    }
+
+    // Per-depth buffers reused by every node queryBatch visits at that depth
+    struct BatchScratch {
+        std::vector<uint32_t> active[kMaxTreeHeight + 1];  // Queries entering the node, by index
+        std::vector<uint64_t> masks[kMaxTreeHeight + 1];   // Entry hits of each active query
+    };
+
+    // Visit node (depth levels below the root) for the queries in scratch.active[depth]
+    void queryBatchRecursive(const RTreeNode* node, size_t depth, const std::vector<Rectangle>& ranges,
+                             BatchScratch& scratch, std::vector<std::vector<PropertyId>>& results) const {
+        const std::vector<uint32_t>& active = scratch.active[depth];
+        std::vector<uint64_t>& masks = scratch.masks[depth];
+        masks.resize(active.size());
+        uint64_t any_hit = 0;
+        for (size_t a = 0; a < active.size(); ++a) {
+            masks[a] = node->entry_boxes.intersectMask(ranges[active[a]]);
+            any_hit |= masks[a];
+        }
+
+        if (node->is_leaf) {
+            for (size_t a = 0; a < active.size(); ++a) {
+                std::vector<PropertyId>& out = results[active[a]];
+                for (uint64_t hits = masks[a]; hits;) {
+                    out.push_back(node->leaf_properties[popLowestBit(hits)]);
+                }
+            }
+            return;
+        }
+
+        std::vector<uint32_t>& child_active = scratch.active[depth + 1];
+        while (any_hit) {
+            unsigned i = popLowestBit(any_hit);
+            child_active.clear();
+            for (size_t a = 0; a < active.size(); ++a) {
+                if ((masks[a] >> i) & 1) {
+                    child_active.push_back(active[a]);
+                }
+            }
+            queryBatchRecursive(node->children[i], depth + 1, ranges, scratch, results);
+        }
+    }
+
+    // Start loading the parts of node a traversal reads first: the box column headers and the
+    // fields after them
+    static void prefetchNode(const RTreeNode* node) {
+        prefetchRead(&node->entry_boxes.x_min);
+        prefetchRead(&node->entry_boxes.x_max);
+        prefetchRead(&node->is_leaf);
+    }
+
+    // Distance measures ordering kNearest: squared distance in planar mode, the haversine term in
+    // geographic mode. Both grow with the true distance.
+    double minDistanceKey(const Rectangle& box, double x, double y) const {
+        if (options.coordinates == CoordinateMode::Geographic) {
+            return geoMinHaversine(box, x, y);
         }
+        return box.minDistanceSquared(x, y);
+    }
+
+    double minDistanceKey(const BoxColumns& boxes, size_t i, double x, double y) const {
+        if (options.coordinates == CoordinateMode::Geographic) {
+            return geoMinHaversine(boxes.box(i), x, y);
+        }
+        return boxes.minDistanceSquared(i, x, y);
+    }
+
+    double centerDistanceKey(const BoxColumns& boxes, size_t i, double x, double y) const {
+        if (options.coordinates == CoordinateMode::Geographic) {
+            Rectangle box = boxes.box(i);
+            return haversineTerm(x, y, box.centerX(), box.centerY());
+        }
+        return boxes.centerDistanceSquared(i, x, y);
+    }
+
+    // Geographic counterpart of collectCircleCandidates: entries hitting one of the circle's
+    // search_boxes whose great-circle MINDIST from (lon, lat) has a haversine term within limit
+    void collectGeoCandidates(const RTreeNode* node, double lon, double lat, double limit, const Rectangle search_boxes[2],
+                              size_t search_count, const PropertyFilter& filter, std::vector<PropertyId>& results) const {
+        if (!node->stats.mayMatch(filter)) return;
 
-        bounding_box = Rectangle(x_min, y_min, x_max, y_max);
+        uint64_t hits = 0;
+        for (size_t b = 0; b < search_count; ++b) {
+            hits |= node->entry_boxes.intersectMask(search_boxes[b]);
+        }
+        while (hits) {
+            unsigned i = popLowestBit(hits);
+            if (geoMinHaversine(node->entry_boxes.box(i), lon, lat) > limit) continue;
+            if (node->is_leaf) {
+                results.push_back(node->leaf_properties[i]);
+            } else {
+                collectGeoCandidates(node->children[i], lon, lat, limit, search_boxes, search_count, filter, results);
+            }
+        }
+    }
+
+    // Properties whose boxes come within squared distance radius_sq of (x, y), in subtrees whose
+    // stats do not rule out filter. Leaf entries are not tested against filter or by their centre
+    // here; queryCircle does that in bulk.
+    void collectCircleCandidates(const RTreeNode* node, double x, double y, double radius_sq, const PropertyFilter& filter,
+                                 std::vector<PropertyId>& results) const {
+        if (node->bounding_box.minDistanceSquared(x, y) > radius_sq || !node->stats.mayMatch(filter)) return;
+
+        uint64_t hits = node->entry_boxes.withinDistanceMask(x, y, radius_sq);
+        while (hits) {
+            unsigned i = popLowestBit(hits);
+            if (node->is_leaf) {
+                results.push_back(node->leaf_properties[i]);
+            } else {
+                collectCircleCandidates(node->children[i], x, y, radius_sq, filter, results);
+            }
+        }
     }
 };
 
-// Represents the R-tree structure
-class RTree {
-    RTreeNode* root;
+// Read-only snapshot of an RTree for serving replicas. All nodes live in one array in
+// breadth-first order, so the children of a node are a contiguous run addressed by offset, and
+// all leaf entries live in a second array in the same leaf order. Entries are row ids into the
+// source tree's PropertyStore, so the tree must outlive the snapshot, and since a modified tree
+// recycles rows, a snapshot is only usable until the tree changes; after that query() returns
+// nothing and valid() is false.
+class FrozenRTree {
+    struct FlatNode {
+        uint32_t first;  // Index of the first child in nodes, or of the first property in entries
+        uint32_t count;  // Number of children or properties
+        bool is_leaf;
+    };
+
+    std::vector<FlatNode> nodes;  // nodes[0] is the root
+    BoxColumns node_boxes;        // Bounding box of nodes[i]
+    std::vector<PropertyId> entries;
+    BoxColumns entry_boxes;       // Bounding box of entries[i]
+    const RTree* source;
+    uint64_t epoch;               // Epoch of source when the snapshot was taken
 
 public:
-    RTree() {
-        root = new RTreeNode(Rectangle(0, 0, 100, 100), true); // Define an initial bounding box
-    }
+    explicit FrozenRTree(const RTree& tree) : source(&tree), epoch(tree.epoch) {
+        std::vector<const RTreeNode*> order;  // Source nodes in breadth-first order
+        order.push_back(tree.root);
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (const auto& child : order[i]->children) {
+                order.push_back(child);
+            }
+        }
 
-    // Insert a property into the R-tree
-    void insert(Property* prop) {
-        root->insert(prop);
+        nodes.reserve(order.size());
+        uint32_t next_child = 1;
+        for (const auto& node : order) {
+            FlatNode flat;
+            flat.is_leaf = node->is_leaf;
+            node_boxes.push_back(node->bounding_box);
+            if (node->is_leaf) {
+                flat.first = static_cast<uint32_t>(entries.size());
+                flat.count = static_cast<uint32_t>(node->leaf_properties.size());
+                for (const auto& prop : node->leaf_properties) {
+                    entries.push_back(prop);
+                    entry_boxes.push_back(tree.store.box(prop));
+                }
+            } else {
+                flat.first = next_child;
+                flat.count = static_cast<uint32_t>(node->children.size());
+                next_child += flat.count;
+            }
+            nodes.push_back(flat);
+        }
     }
 
+    // The snapshot keeps a pointer to its source, so it must not be built from a temporary
+    FrozenRTree(const RTree&&) = delete;
+
+    bool valid() const { return epoch == source->epoch; }
+
+    size_t nodeCount() const { return nodes.size(); }
+    size_t size() const { return entries.size(); }
+
     // Query properties within a specified range
-    std::vector<Property*> query(Rectangle range) {
-        std::vector<Property*> results;
-        queryRecursive(root, range, results);
+    std::vector<PropertyId> query(const Rectangle& range) const {
+        std::vector<PropertyId> results;
+        if (!valid() || nodes.empty() || !node_boxes.box(0).intersects(range)) return results;
+
+        std::vector<uint32_t> pending = {0};
+        while (!pending.empty()) {
+            const FlatNode& node = nodes[pending.back()];
+            pending.pop_back();
+
+            const BoxColumns& boxes = node.is_leaf ? entry_boxes : node_boxes;
+            uint64_t hits = boxes.intersectMask(range, node.first, node.count);
+            while (hits) {
+                uint32_t i = node.first + popLowestBit(hits);
+                if (node.is_leaf) {
+                    results.push_back(entries[i]);
+                } else {
+                    pending.push_back(i);
+                }
+            }
+        }
         return results;
     }
+};
 
-    // Query properties near a specified location and within a distance range
-    std::vector<Property*> queryNearLocation(double x, double y, double distance_km, double max_price, double min_area, int min_bedrooms) {
-        std::vector<Property*> results;
-        Rectangle search_area(x - distance_km, y - distance_km, x + distance_km, y + distance_km);
-        std::vector<Property*> properties = query(search_area);
+// Range query over an RTree that hands out results a page at a time. The traversal state is an
+// explicit stack of (node, entries still to visit) frames, so the query can stop after any result
+// and continue later in the same order query() would produce. A cursor is only usable while the
+// tree is unmodified; after that next() returns nothing and valid() is false.
+class QueryCursor {
+    struct Frame {
+        const RTreeNode* node;
+        uint64_t pending;  // Entries of node intersecting the range and not visited yet
+        uint32_t index;    // Position of node among its parent's children (0 for the root)
+    };
 
-        for (const auto& prop : properties) {
-            double dist = calculateDistance(x, y, (prop->bbox.x_min + prop->bbox.x_max) / 2, (prop->bbox.y_min + prop->bbox.y_max) / 2);
-            // cout<<"dist is"<<dist<<endl;
-            if (dist <= distance_km &&
-                prop->price <= max_price &&
-                prop->area >= min_area &&
-                prop->bedrooms >= min_bedrooms) {
-                results.push_back(prop);
+    const RTree* tree;
+    Rectangle range;
+    uint64_t epoch;
+    std::vector<Frame> stack;
+
+public:
+    QueryCursor(const RTree& source, const Rectangle& query_range)
+        : tree(&source), range(query_range), epoch(source.epoch) {
+        const RTreeNode* root = tree->root;
+        if (root->bounding_box.intersects(range)) {
+            stack.push_back(Frame{root, root->entry_boxes.intersectMask(range), 0});
+        }
+    }
+
+    // The cursor keeps a pointer to the tree, so it must not be built over a temporary
+    QueryCursor(const RTree&&, const Rectangle&) = delete;
+
+    bool valid() const { return epoch == tree->epoch; }
+
+    // True once every result has been returned
+    bool done() const { return stack.empty(); }
+
+    // Up to n further results
+    std::vector<PropertyId> next(size_t n) {
+        std::vector<PropertyId> page;
+        if (!valid()) return page;
+
+        while (page.size() < n && !stack.empty()) {
+            Frame& top = stack.back();
+            if (!top.pending) {
+                stack.pop_back();
+                continue;
+            }
+            unsigned i = popLowestBit(top.pending);
+            if (top.node->is_leaf) {
+                page.push_back(top.node->leaf_properties[i]);
+            } else {
+                const RTreeNode* child = top.node->children[i];
+                stack.push_back(Frame{child, child->entry_boxes.intersectMask(range), i});
             }
         }
+        // Drop finished frames so that done() is exact
+        while (!stack.empty() && !stack.back().pending) {
+            stack.pop_back();
+        }
+        return page;
+    }
 
-        return results;
+    // Opaque text from which resume() can recreate this cursor: the range, the tree epoch and, for
+    // each frame, its child index and pending entries, all as fixed-width hex
+    std::string token() const {
+        std::string out = "q1";
+        appendHex(out, epoch, 16);
+        for (double bound : {range.x_min, range.y_min, range.x_max, range.y_max}) {
+            uint64_t bits;
+            std::memcpy(&bits, &bound, sizeof(bits));
+            appendHex(out, bits, 16);
+        }
+        appendHex(out, stack.size(), 4);
+        for (const auto& frame : stack) {
+            appendHex(out, frame.index, 2);
+            appendHex(out, frame.pending, 16);
+        }
+        return out;
     }
 
-private:
-    // Recursive function to perform the query
-    void queryRecursive(RTreeNode* node, Rectangle range, std::vector<Property*>& results) {
-        if (!node->bounding_box.intersects(range)) return;
+    // Continue from a token of a cursor over the same tree. Returns false, leaving this cursor
+    // unchanged, if the token is malformed, was issued by another tree (or before a clear or bulk
+    // load of this one), or the tree has been modified since it was issued.
+    bool resume(std::string_view text) {
+        uint64_t token_epoch, depth;
+        double bounds[4];
+        if (text.substr(0, 2) != "q1") return false;
+        text.remove_prefix(2);
+        if (!readHex(text, 16, token_epoch) || token_epoch != tree->epoch) return false;
+        for (double& bound : bounds) {
+            uint64_t bits;
+            if (!readHex(text, 16, bits)) return false;
+            std::memcpy(&bound, &bits, sizeof(bits));
+        }
+        if (!readHex(text, 4, depth)) return false;
 
-        if (node->is_leaf) {
-            for (const auto& prop : node->leaf_properties) {
-                if (range.intersects(prop->bbox)) {
-                    results.push_back(prop);
-                }
-            }
-        } else {
-            for (const auto& child : node->children) {
-                queryRecursive(child, range, results);
+        std::vector<Frame> frames;
+        const RTreeNode* parent = nullptr;
+        for (uint64_t level = 0; level < depth; ++level) {
+            uint64_t index, pending;
+            if (!readHex(text, 2, index) || !readHex(text, 16, pending)) return false;
+
+            const RTreeNode* node;
+            if (!parent) {
+                if (index != 0) return false;
+                node = tree->root;
+            } else {
+                if (parent->is_leaf || index >= parent->children.size()) return false;
+                node = parent->children[index];
             }
+            size_t count = node->entryCount();
+            if (count < 64 && (pending >> count) != 0) return false;
+            frames.push_back(Frame{node, pending, static_cast<uint32_t>(index)});
+            parent = node;
+        }
+        if (!text.empty()) return false;
+
+        range = Rectangle(bounds[0], bounds[1], bounds[2], bounds[3]);
+        epoch = token_epoch;
+        stack.swap(frames);
+        return true;
+    }
+
+private:
+    static void appendHex(std::string& out, uint64_t value, int digits) {
+        static const char kDigits[] = "0123456789abcdef";
+        for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+            out.push_back(kDigits[(value >> shift) & 0xf]);
         }
     }
 
-    // Calculate the Euclidean distance between two points (latitude and longitude) in kilometers
-    double calculateDistance(double x1, double y1, double x2, double y2) {
-        int distance= sqrt(pow((x2-x1),2) + pow((y2-y1),2));
-        return distance;
+    static bool readHex(std::string_view& in, size_t digits, uint64_t& value) {
+        if (in.size() < digits) return false;
+        value = 0;
+        for (size_t i = 0; i < digits; ++i) {
+            char c = in[i];
+            int digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else {
+                return false;
+            }
+            value = (value << 4) | static_cast<uint64_t>(digit);
+        }
+        in.remove_prefix(digits);
+        return true;
     }
 };
 
+// Print one line per property, or message when there are none
+void printProperties(const RTree& tree, const std::vector<PropertyId>& results, const std::string& message) {
+    std::cout << "Query results:\n";
+    if (results.empty()) {
+        std::cout << message << "\n";
+        return;
+    }
+    for (const auto& id : results) {
+        Property prop = tree.property(id);
+        std::cout << "Location: " << tree.locationName(prop)
+                  << ", Price: $" << prop.price
+                  << ", Area: " << prop.area << " sq. ft."
+                  << ", Bedrooms: " << prop.bedrooms
+                  << ", Bounding Box: (" << prop.bbox.x_min << ", " << prop.bbox.y_min
+                  << ", " << prop.bbox.x_max << ", " << prop.bbox.y_max << ")\n";
+    }
+}
+
 // Clear input buffer function
 void clearInputBuffer() {
     std::cin.clear();
@@ -158,7 +2775,7 @@ int main() {
 
     do {
         std::cout << "\nReal Estate Property System\n";
-        std::cout << "1. Insert Property\n2. Query Properties\n3. Query Near Location\n4. Exit\n";
+        std::cout << "1. Insert Property\n2. Query Properties\n3. Query Near Location\n4. Find Nearest Properties\n5. Memory Report\n6. Exit\n";
         std::cout << "Enter your choice: ";
         std::cin >> choice;
         clearInputBuffer(); // Clear any leftover newline characters
@@ -197,8 +2814,7 @@ int main() {
             }
 
             Rectangle bbox(x_min, y_min, x_max, y_max);
-            Property* prop = new Property(location, price, area, bedrooms, bbox);
-            tree.insert(prop);
+            tree.insert(Property(tree.internLocation(location), price, area, bedrooms, bbox));
             std::cout << "Property inserted.\n";
 
         } else if (choice == 2) {
@@ -211,19 +2827,7 @@ int main() {
             Rectangle query_range(q_x_min, q_y_min, q_x_max, q_y_max);
 
             auto results = tree.query(query_range);
-            std::cout << "Query results:\n";
-            if (results.empty()) {
-                std::cout << "No properties found within the specified range.\n";
-            } else {
-                for (const auto& prop : results) {
-                    std::cout << "Location: " << prop->location
-                              << ", Price: $" << prop->price
-                              << ", Area: " << prop->area << " sq. ft."
-                              << ", Bedrooms: " << prop->bedrooms
-                              << ", Bounding Box: (" << prop->bbox.x_min << ", " << prop->bbox.y_min
-                              << ", " << prop->bbox.x_max << ", " << prop->bbox.y_max << ")\n";
-                }
-            }
+            printProperties(tree, results, "No properties found within the specified range.");
 
         } else if (choice == 3) {
             double user_x, user_y, distance_km, max_price, min_area;
@@ -260,26 +2864,40 @@ int main() {
             }
 
             auto results = tree.queryNearLocation(user_x, user_y, distance_km, max_price, min_area, min_bedrooms);
-            std::cout << "Query results:\n";
-            if (results.empty()) {
-                std::cout << "No properties found within the specified criteria.\n";
-            } else {
-                for (const auto& prop : results) {
-                    std::cout << "Location: " << prop->location
-                              << ", Price: $" << prop->price
-                              << ", Area: " << prop->area << " sq. ft."
-                              << ", Bedrooms: " << prop->bedrooms
-                              << ", Bounding Box: (" << prop->bbox.x_min << ", " << prop->bbox.y_min
-                              << ", " << prop->bbox.x_max << ", " << prop->bbox.y_max << ")\n";
-                }
-            }
+            printProperties(tree, results, "No properties found within the specified criteria.");
 
         } else if (choice == 4) {
+            double user_x, user_y;
+            int count;
+
+            std::cout << "Enter your location (x y): ";
+            while (!(std::cin >> user_x >> user_y)) {
+                std::cout << "Invalid input. Enter your location (x y): ";
+                clearInputBuffer();
+            }
+
+            std::cout << "Enter number of properties to find: ";
+            while (!(std::cin >> count) || count < 0) {
+                std::cout << "Invalid input. Please enter a non-negative integer: ";
+                clearInputBuffer();
+            }
+
+            auto results = tree.kNearest(user_x, user_y, count);
+            printProperties(tree, results, "No properties found.");
+
+        } else if (choice == 5) {
+            MemoryReport report = tree.memoryReport();
+            std::cout << "Properties: " << report.property_count
+                      << ", Distinct locations: " << report.distinct_locations << "\n";
+            std::cout << "Bytes per property with a string per property: " << report.legacyBytesPerProperty() << "\n";
+            std::cout << "Bytes per property with interned locations: " << report.bytesPerProperty() << "\n";
+
+        } else if (choice == 6) {
             std::cout << "Exiting...\n";
         } else {
             std::cout << "Invalid choice. Please try again.\n";
         }
-    } while (choice != 4);
+    } while (choice != 6);
 
     return 0;
 }
\ No newline at end of file